@@ -4,7 +4,9 @@
 
 
 /* Includes */
+#include <stddef.h>
 #include <stdint.h>
+#include "libpfcabi.h"
 #include "libpfcmsr.h"
 
 
@@ -13,6 +15,25 @@
 typedef uint64_t  PFC_CFG;
 typedef int64_t   PFC_CNT;
 
+/**
+ * Multiplexing totals, summed over all CPUs.
+ *
+ *     groups:     Number of slots being rotated through, 0 to groups-1.
+ *     enabledNs:  Time multiplexing has been on (CPU-ns).
+ *     runningNs:  Time each slot was programmed into the counters (CPU-ns).
+ *     raw:        Counts each slot accumulated while programmed.
+ *     est:        raw scaled by enabledNs/runningNs, or 0 if never run.
+ */
+
+typedef struct PFC_MUX{
+	int       groups;
+	uint64_t  periodNs;
+	uint64_t  enabledNs;
+	uint64_t  runningNs[PFC_ABI_NSLOTS];
+	uint64_t  raw      [PFC_ABI_NSLOTS][7];
+	double    est      [PFC_ABI_NSLOTS][7];
+} PFC_MUX;
+
 /**
  * The next three definitions are the positions of the three fixed counters within
  * the PFC_CNT array
@@ -39,6 +60,9 @@ typedef int64_t   PFC_CNT;
 #define PFC_ERR_CR4_PCE_NOT_SET (-5) /* Driver reported that cr4.pce wasn't set, or there was somehow an issue reading it */
 #define PFC_ERR_AFFINITY_FAILED (-6) /* Setting CPU affinity failed (perhaps affinity is set externally excluding CPU 0?) */
 #define PFC_ERR_READING_MASKS   (-7) /* Didn't read the expected number of mask bytes from the sysfs */
+#define PFC_ERR_OFFCORE_UNSET   (-8) /* An offcore response event was written before its MSR_OFFCORE_RSP_x */
+#define PFC_ERR_UNKNOWN_EVENT   (-9) /* An event name did not parse */
+#define PFC_ERR_CFG_REJECTED    (-10)/* pfc.ko disabled a requested event on this counter or model */
 
 
 /* Extern "C" Guard */
@@ -62,6 +86,72 @@ void      pfcFini          (void);
  */
 int      pfcPinThread     (int core);
 
+/**
+ * Topology-aware placement.
+ *
+ * pfcPlace() picks a CPU for the calling thread from the online CPUs of its
+ * affinity mask, using sysfs topology and 100ms of /proc/stat: Isolated
+ * (isolcpus/nohz_full) CPUs first, then the least busy physical core, CPU 0
+ * last. With PFC_PLACE_ISOLATED only isolated CPUs are considered; With
+ * PFC_PLACE_SIBLING_IDLE only CPUs whose SMT siblings are idle or offline.
+ * The thread is then pinned there, unless PFC_PLACE_NOPIN. Returns 0, or
+ * PFC_ERR_CPU_PIN_FAILED if no CPU qualifies, pinning failed or memory ran
+ * out. p describes the choice, and p->report does so in one line of text.
+ * Threads may call pfcPlace() concurrently.
+ *
+ * pfcPlaceAlloc() maps size bytes and touches every page from the calling
+ * thread, so that under the default NUMA policy a pinned thread's buffers
+ * land on its own node. pfcPlaceFree() unmaps them.
+ */
+
+#define PFC_PLACE_ISOLATED      0x1
+#define PFC_PLACE_SIBLING_IDLE  0x2
+#define PFC_PLACE_NOPIN         0x4
+
+typedef struct PFC_PLACEMENT{
+	int       cpu;
+	int       core;         /* topology/core_id */
+	int       package;
+	int       node;         /* NUMA node, or -1 */
+	int       isolated;
+	double    busy;         /* Fraction of the sampling window not idle */
+	int       siblings;     /* Online SMT siblings */
+	double    siblingBusy;  /* Busiest sibling */
+	int       l2Sharers;    /* Other online CPUs sharing the L2, or -1 */
+	int       llcSharers;   /* Other online CPUs sharing the LLC, or -1 */
+	char      report[512];
+} PFC_PLACEMENT;
+
+int       pfcPlace         (int flags, PFC_PLACEMENT* p);
+void*     pfcPlaceAlloc    (size_t size);
+void      pfcPlaceFree     (void* ptr, size_t size);
+
+/**
+ * Benchmark quiescing. Requires root.
+ *
+ * pfcQuiesce() requests P-state ratio (multiples of the bus clock; 0 for the
+ * nominal ratio, <0 to leave it alone) on each of the ncpus CPUs and, per
+ * flags, disables turbo, sets EPB to performance (0) and sets
+ * FREEZE_WHILE_SMM, so that counters stop during SMIs. The prior value of
+ * every MSR changed is recorded first. pfcRestore() writes them back exactly;
+ * It runs automatically at exit and on fatal signals left at their default
+ * disposition, but not on SIGKILL; Handlers the application installed itself
+ * are left alone, so call pfcRestore() from them if they do not exit().
+ * A second pfcQuiesce() restores the first's state before applying its own.
+ * Returns 0, or a PFC_ERR_* code after restoring whatever had been changed.
+ *
+ * A cpufreq driver may rewrite PERF_CTL: Use the performance or userspace
+ * governor, or intel_pstate in passive mode, while quiesced.
+ */
+
+#define PFC_QUIESCE_NOTURBO     0x1
+#define PFC_QUIESCE_EPB         0x2
+#define PFC_QUIESCE_FREEZE_SMM  0x4
+#define PFC_QUIESCE_ALL         0x7
+
+int       pfcQuiesce       (const int* cpus, int ncpus, int ratio, int flags);
+void      pfcRestore       (void);
+
 /**
  * Read and write the configurations and values of the n counters starting at
  * counter k.
@@ -70,22 +160,404 @@ int      pfcPinThread     (int core);
 /* Writes n configuration values from cfg, starting at counter k. Returns 0 on success or an error code otherwise. */
 int       pfcWrCfgs        (int k, int n, const PFC_CFG* cfg);
 int       pfcRdCfgs        (int k, int n,       PFC_CFG* cfg);
+/* Both go through the kernel; Prefer pfcSoftZero()/pfcRdpmcCnts() below unless the hardware must be reset. */
 int       pfcWrCnts        (int k, int n, const PFC_CNT* cnt);
 int       pfcRdCnts        (int k, int n,       PFC_CNT* cnt);
+int       pfcRdMasks       (int k, int n,       uint64_t* msk);
 int       pfcRdMSR         (uint64_t off,       uint64_t* msr);
 
+/**
+ * Counters are per CPU, and pfcWrCfgs() only programs the one the calling
+ * thread is running on. pfcWrCfgsAll() programs every CPU of the calling
+ * thread's affinity mask by pinning to each in turn, then restores the mask.
+ *
+ * pfcCfgSignature() returns a non-zero hash of the 7 configurations of a CPU
+ * as this process last wrote them, through pfcWrCfgs() or pfcSwitchSlot(),
+ * or 0 if unknown: Not all 7 written, or the writer migrated meanwhile. It is
+ * computed from the values written rather than read back, so it costs
+ * configuration writes nothing but two RDTSCPs.
+ */
+
+int       pfcWrCfgsAll     (int k, int n, const PFC_CFG* cfg);
+uint64_t  pfcCfgSignature  (int cpu);
+
+/**
+ * Remote reads.
+ *
+ * pfcRdCntsOn() reads the n counters starting at counter k of another CPU,
+ * which pfc.ko interrupts to read its own counters; The caller neither
+ * migrates nor disturbs anything else. Returns bytes read like pfcRdCnts().
+ *
+ * pfcRdCntsOnSet() reads the 7 counters of ncpus CPUs into cnt, with one
+ * read, and thus one IPI batch, per 64-CPU window (CPUs 0-63, 64-127, ...).
+ * Only CPUs within the same window are snapshotted together. Offline CPUs
+ * read as zeroes. Returns 0 or -1.
+ *
+ * Both fail with PFC_ERR_OPENING_SYSFILE if the loaded pfc.ko predates them.
+ */
+
+int       pfcRdCntsOn      (int cpu, int k, int n, PFC_CNT* cnt);
+int       pfcRdCntsOnSet   (const int* cpus, int ncpus, PFC_CNT (*cnt)[7]);
+
+/**
+ * Configuration slots.
+ *
+ * pfcLoadSlot() preloads n configurations, starting at counter k, into slot s
+ * (0 to 7) of every CPU, without touching the counters. pfcSwitchSlot()
+ * then reprograms all counters of the calling thread's CPU from slot s and
+ * zeroes them, gating them off and back on together so that they all start
+ * on the same cycle. Both return 0 or a PFC_ERR_* code;
+ * PFC_ERR_OPENING_SYSFILE if the loaded pfc.ko predates slots.
+ */
+
+int       pfcLoadSlot      (int s, int k, int n, const PFC_CFG* cfg);
+int       pfcSwitchSlot    (int s);
+
+/**
+ * Multiplexing.
+ *
+ * pfcMuxStart() has every CPU rotate its counters through slots 0 to
+ * groups-1, preloaded with pfcLoadSlot(), switching every periodNs
+ * nanoseconds (at least 100us) on a kernel timer and accumulating 64-bit
+ * totals per slot. pfcMuxRead() returns the totals so far and their scaled
+ * estimates; They remain readable after pfcMuxStop(). pfcMuxStart() and
+ * pfcMuxStop() return 0 or a PFC_ERR_* code, pfcMuxRead() 0 or -1.
+ *
+ * Counters are system-wide: The estimates cover everything that ran on any
+ * CPU, and are only as good as the assumption that each event occurs at a
+ * steady rate across rotations.
+ */
+
+int       pfcMuxStart      (int groups, uint64_t periodNs);
+int       pfcMuxStop       (void);
+int       pfcMuxRead       (PFC_MUX* m);
+
 /**
  * Translate argument to configuration.
  */
 
 PFC_CFG   pfcParseCfg      (const char* s);
 
+/**
+ * Offcore response events.
+ *
+ * offcore_response_0.any (0xB7) and offcore_response_1.any (0xBB) count the
+ * requests and responses selected by MSR_OFFCORE_RSP_0 and _1, which are
+ * shared by all counters of a CPU. Both are spelt after an '@' in event
+ * strings, e.g. "offcore_response_0.any@local_dram". pfcParseCfg() ignores
+ * that part; pfcParseOffcore() turns it (or a bare response string) into the
+ * MSR value: '+'-separated presets or numbers, ORed together, defaulting to
+ * the all_data_rd request if no request bits (15:0) are given and to
+ * any_response if no response bits (37:16) are. Returns 0 if it cannot parse
+ * it.
+ *
+ * Request presets: demand_data_rd, demand_rfo, demand_code_rd, all_data_rd,
+ * all_rfo. Response presets: any_response, llc_hit, llc_hit_snoop (L3 hit
+ * that snooped another core's copy), local_dram, remote_dram. They follow
+ * the Haswell through Skylake encoding, except for all_data_rd, which only
+ * includes L1D and software prefetches (bit 10) from Skylake on, since that
+ * bit selects bus locks on Haswell and Broadwell.
+ *
+ * pfcWrOffcore()/pfcRdOffcore() write and read n of the MSRs, starting at k,
+ * on the calling thread's CPU, like pfcWrCfgs()/pfcRdCfgs(); Write them
+ * first, since pfc.ko will not enable an offcore event whose MSR selects no
+ * request. pfcWrCfgs() refuses such an event with PFC_ERR_OFFCORE_UNSET
+ * rather than leave its counter silently disabled. pfc.ko only accepts them
+ * on Haswell through Comet Lake, masking off reserved request bits; On other
+ * models, pfcWrOffcore() fails and pfcWrCfgs() refuses offcore events.
+ */
+
+uint64_t  pfcParseOffcore  (const char* s);
+int       pfcWrOffcore     (int k, int n, const uint64_t* rsp);
+int       pfcRdOffcore     (int k, int n,       uint64_t* rsp);
+
 /**
  * Dump out available events
  */
 
 void      pfcDumpEvts      (void);
 
+/**
+ * Clock domains.
+ * 
+ * pfcClkInit() determines, once per process, the frequencies of the clocks
+ * that the counters and the TSC tick at, from CPUID leaves 0x15/0x16,
+ * MSR_PLATFORM_INFO (if pfc.ko is loaded and pfcInit() was called first), and
+ * a short calibration of the TSC against CLOCK_MONOTONIC_RAW. The results are
+ * cached; later calls return the same pointer immediately.
+ * 
+ * All frequencies are in Hz; 0 means "could not be determined".
+ * 
+ *     tscHz:      TSC rate. CPU_CLK_UNHALTED.REF_TSC also ticks at this rate.
+ *     nominalHz:  Maximum non-turbo core frequency.
+ *     xclkHz:     Rate of CPU_CLK_UNHALTED.REF_XCLK: the 100MHz bus clock
+ *                 before Skylake, the core crystal clock from Skylake onward.
+ *     crystalHz:  Core crystal clock (CPUID.15H.ECX or per-model table).
+ *     measuredHz: TSC rate measured against CLOCK_MONOTONIC_RAW.
+ *     tscSrc:     Which PFC_CLK_SRC_* tscHz was derived from.
+ */
+
+#define PFC_CLK_SRC_NONE        0 /* Unknown */
+#define PFC_CLK_SRC_CPUID15     1 /* CPUID.15H TSC/crystal ratio */
+#define PFC_CLK_SRC_CPUID16     2 /* CPUID.16H base frequency */
+#define PFC_CLK_SRC_PLATINFO    3 /* MSR_PLATFORM_INFO nominal ratio times bus clock */
+#define PFC_CLK_SRC_MEASURED    4 /* Calibration against CLOCK_MONOTONIC_RAW */
+
+typedef struct PFC_CLK{
+	double    tscHz;
+	double    nominalHz;
+	double    xclkHz;
+	double    crystalHz;
+	double    measuredHz;
+	int       tscSrc;
+} PFC_CLK;
+
+const PFC_CLK* pfcClkInit     (void);
+
+/**
+ * Convert TSC ticks, CPU_CLK_UNHALTED.REF_TSC counts, CPU_CLK_UNHALTED.THREAD
+ * counts and CPU_CLK_UNHALTED.REF_XCLK counts to nanoseconds.
+ * 
+ * pfcCycToNs() assumes the core ran at its nominal frequency; Under
+ * TurboBoost, prefer pfcRefToNs() on the REF_TSC count of the same region.
+ */
+
+double    pfcTscToNs       (int64_t tsc);
+double    pfcRefToNs       (int64_t ref);
+double    pfcCycToNs       (int64_t cyc);
+double    pfcXclkToNs      (int64_t xclk);
+
+/**
+ * Summary statistics of a set of samples.
+ * 
+ * pfcStats() computes them over the n samples in x, which it leaves
+ * untouched. Returns 0 on success, non-zero if n is 0 or memory ran out.
+ * pfcStatsValid() does the same over only the samples whose tag (see
+ * pfcValidEnd()) is PFC_VALID_CLEAN, and counts the others in dropped.
+ */
+
+typedef struct PFC_STATS{
+	size_t    n;
+	double    min, p50, p90, p99, max;
+	double    mean, stddev;
+	size_t    dropped;
+} PFC_STATS;
+
+int       pfcStats         (const double* x, size_t n, PFC_STATS* s);
+int       pfcStatsValid    (const double* x, const int* tags, size_t n, PFC_STATS* s);
+
+/**
+ * Median counts of a piece of code under one group of events.
+ *
+ * pfcMeasure() programs the calling thread's CPU with the fixed counters
+ * (user mode) and up to 4 general-purpose events named in evts (NULL or ""
+ * for none), zeroes them and runs fn(arg) once untimed. It then runs it reps
+ * times (at most PFC_MEASURE_MAXREPS), each bracketed by PFCSTART/PFCEND with
+ * the bias removed, and writes into out the median of each of the 7 counts
+ * divided by units. Returns 0, or a PFC_ERR_* code with nothing measured:
+ * PFC_ERR_UNKNOWN_EVENT if a name does not parse, PFC_ERR_CFG_REJECTED if
+ * pfc.ko disabled an event rather than program it (restricted to other
+ * counters, or unsupported on this model), or what pfcWrCfgs() returned.
+ */
+
+#define PFC_MEASURE_MAXREPS     64
+
+int       pfcMeasure       (const char* const* evts, void (*fn)(void*), void* arg,
+                            int reps, double units, double* out);
+
+/**
+ * Interleaved A/B comparison.
+ *
+ * pfcAB() runs a(arg) and b(arg) n times each, under the current counter
+ * configuration, as n pairs in random order so that frequency and thermal
+ * drift affect both alike. Each call is bracketed by PFCSTART/PFCEND, bias
+ * removed. For every counter it reports the medians of A and B, the median of
+ * the paired differences B-A with its 95% bootstrap interval, and the p-value
+ * of a two-sided Mann-Whitney U test of A against B. verdict is -1 if B counts
+ * significantly fewer events (p < 0.05 and an interval excluding 0), +1 if
+ * more, 0 otherwise. Returns 0, or -1 if n < 2 or memory ran out.
+ *
+ * pfcABDump() prints a result to stdout, under the given 7 counter names if
+ * names is not NULL.
+ */
+
+typedef struct PFC_AB_CNT{
+	double    medA, medB;
+	double    diff, lo, hi;
+	double    p;
+	int       verdict;
+} PFC_AB_CNT;
+
+typedef struct PFC_AB{
+	size_t     n;
+	PFC_AB_CNT cnt[7];
+} PFC_AB;
+
+int       pfcAB            (void (*a)(void*), void (*b)(void*), void* arg,
+                            size_t n, PFC_AB* r);
+void      pfcABDump        (const PFC_AB* r, const char* const* names);
+
+/**
+ * Per-endpoint counter histograms.
+ *
+ * pfcHistRecord() files one region's 7 counter deltas, as left by
+ * PFCSTART/PFCEND, under an endpoint id in [0, PFC_HIST_ENDPOINTS). Each
+ * thread updates its own histograms with plain loads and stores: No locks and
+ * no atomic read-modify-writes. Only the first record of a thread into an
+ * endpoint allocates and registers its histogram, under a mutex. Returns 0,
+ * or -1 if endpoint is out of range or memory ran out.
+ *
+ * Histograms are log-linear: Values below 2^PFC_HIST_SUB_BITS get a bucket
+ * each, and every power of two above is split into 2^PFC_HIST_SUB_BITS equal
+ * buckets, for a relative error under 1/2^PFC_HIST_SUB_BITS. Negative deltas
+ * (e.g. after bias removal) are filed as 0.
+ *
+ * pfcHistSnapshot() merges the histograms of all threads for one endpoint,
+ * and may be called from a reporter thread at any time; Records racing with
+ * it may be partially included. A thread's histograms are folded into those
+ * of exited threads and freed as it exits, so its records remain counted.
+ * pfcHistQuantile() returns the q'th quantile of slot k of a snapshot, as the
+ * midpoint of the bucket it falls in.
+ */
+
+#define PFC_HIST_SUB_BITS  4
+#define PFC_HIST_BUCKETS   ((64-PFC_HIST_SUB_BITS+1) << PFC_HIST_SUB_BITS)
+#define PFC_HIST_ENDPOINTS 256
+
+typedef struct PFC_HIST{
+	uint64_t  n;
+	PFC_CNT   sum[7];
+	uint64_t  bkt[7][PFC_HIST_BUCKETS];
+} PFC_HIST;
+
+int       pfcHistRecord    (int endpoint, const PFC_CNT* cnts);
+int       pfcHistSnapshot  (int endpoint, PFC_HIST* h);
+double    pfcHistQuantile  (const PFC_HIST* h, int k, double q);
+
+/**
+ * Nested named regions.
+ *
+ * pfcRegionEnter()/pfcRegionExit() bracket a region like PFCSTART/PFCEND,
+ * but maintain a per-thread tree of regions keyed by their path of names.
+ * Each node accumulates, over all its calls, inclusive counts and exclusive
+ * counts (inclusive minus that of its children) for all 7 counters. The bias
+ * of the node's own reads and the cost of entering and exiting every
+ * descendant are removed; Both are calibrated on the thread's first enter,
+ * so configure the counters beforehand, and pfcRegionReset() after changing
+ * them.
+ *
+ * Names are compared by pointer first and by content second, and are kept by
+ * pointer: Pass string literals or otherwise long-lived strings.
+ *
+ * pfcRegionRoot() returns the calling thread's (unmeasured) root node, whose
+ * children are the top-level regions. pfcRegionWalk() visits a tree in
+ * preorder; pfcRegionDump() prints the calling thread's tree to stdout.
+ */
+
+typedef struct PFC_REGION PFC_REGION;
+struct PFC_REGION{
+	const char*  name;
+	PFC_REGION*  parent;
+	PFC_REGION*  child;    /* First child */
+	PFC_REGION*  next;     /* Next sibling */
+	uint64_t     calls;
+	PFC_CNT      incl[7];
+	PFC_CNT      excl[7];
+
+	/* Current call; Private */
+	PFC_CNT      raw [7];
+	PFC_CNT      kids[7];
+	PFC_CNT      ovh [7];
+};
+
+void              pfcRegionEnter   (const char* name);
+void              pfcRegionExit    (void);
+void              pfcRegionReset   (void);
+const PFC_REGION* pfcRegionRoot    (void);
+void              pfcRegionWalk    (const PFC_REGION* r,
+                                    void (*fn)(const PFC_REGION* r, int depth, void* arg),
+                                    void* arg);
+void              pfcRegionDump    (void);
+
+/**
+ * Time series rings.
+ *
+ * pfcRingStart() has pfc.ko snapshot the TSC and counters of the CPUs in
+ * cpus (a list such as "0-3,8") every periodNs nanoseconds (at least 100us)
+ * from a kernel timer, into a per-CPU ring of PFC_ABI_RING_NREC records.
+ * Nothing runs in userspace on the sampled CPUs. pfcRingStop() stops all
+ * sampling. Both return 0 or a PFC_ERR_* code.
+ *
+ * pfcRingOpen() maps a CPU's ring read-only, positioned at its oldest record,
+ * and returns 0 or PFC_ERR_OPENING_SYSFILE. pfcRingNext() returns 1 and the
+ * next record, or 0 if the reader has caught up with the kernel; Records
+ * overwritten before they could be read are skipped and counted in lost.
+ * Counts are raw, masked counter values: Difference successive records.
+ */
+
+typedef struct PFC_RING{
+	const uint64_t* base;
+	int             cpu;
+	uint64_t        next;     /* Sequence number of the next record */
+	uint64_t        lost;
+} PFC_RING;
+
+typedef struct PFC_RING_REC{
+	uint64_t  seq;
+	uint64_t  tsc;
+	PFC_CNT   cnt[7];
+} PFC_RING_REC;
+
+int       pfcRingStart     (uint64_t periodNs, const char* cpus);
+int       pfcRingStop      (void);
+int       pfcRingOpen      (PFC_RING* r, int cpu);
+int       pfcRingNext      (PFC_RING* r, PFC_RING_REC* rec);
+void      pfcRingClose     (PFC_RING* r);
+
+/**
+ * Shared-memory counter export.
+ *
+ * pfccollect keeps the counters of every CPU running and publishes their
+ * cumulative 64-bit counts, with the TSC of the snapshot, into a file under
+ * /dev/shm (PFC_SHM_PATH by default): A PFC_SHM header followed by one
+ * PFC_SHM_CPU row per CPU number, each guarded by a seqlock. Readers map it
+ * with pfcShmOpen() and take consistent snapshots of a row with pfcShmRead()
+ * without any system call; It returns 0, or -1 if the CPU has no row, was
+ * never published or stayed mid-update (a writer that died). periodNs drops
+ * to 0 when the collector exits.
+ *
+ * pfcShmCreate() and pfcShmPublish() are the writer's side. There must be a
+ * single writer per file. pfcShmCreate() replaces any previous export
+ * atomically, so that readers still mapping it are not cut short; It returns
+ * NULL on failure, as does pfcShmOpen() if the file is missing or not an
+ * export. pfcShmClose() unmaps either side's mapping.
+ */
+
+#define PFC_SHM_PATH     "/dev/shm/pfc"
+#define PFC_SHM_MAGIC    0x314D485343465000ULL /* "\0PFCSHM1" */
+
+typedef struct PFC_SHM_CPU{
+	uint64_t  seq;        /* Odd while being written, 0 if never */
+	uint64_t  tsc;
+	PFC_CNT   cnt[7];
+	uint64_t  pad[7];
+} PFC_SHM_CPU;
+
+typedef struct PFC_SHM{
+	uint64_t    magic;
+	uint64_t    ncpus;
+	uint64_t    periodNs;
+	PFC_CFG     cfg[7];
+	uint64_t    pad[6];
+	PFC_SHM_CPU cpu[];
+} PFC_SHM;
+
+PFC_SHM*  pfcShmCreate     (const char* path, int ncpus, uint64_t periodNs, const PFC_CFG* cfg);
+void      pfcShmPublish    (PFC_SHM* m, int cpu, uint64_t tsc, const PFC_CNT* cnt);
+const PFC_SHM* pfcShmOpen  (const char* path);
+int       pfcShmRead       (const PFC_SHM* m, int cpu, PFC_CNT* cnt, uint64_t* tsc);
+void      pfcShmClose      (const PFC_SHM* m);
+
 
 /*********************
  *****  MACROS   *****
@@ -100,8 +572,50 @@ void      pfcDumpEvts      (void);
 "\n\t"
 
 
-#define _pfc_asm_code_(op)                      \
-"\n\tlfence                                  "  \
+/**
+ * Serialization policies for the read sequence.
+ * 
+ * Each policy is a pair of instruction sequences placed before and after the
+ * 7 rdpmc's, and is named by the token suffix of the _pfc_asm_pre_/_post_
+ * macros below. The matching PFC_SER_* constant selects the same policy at
+ * run time in pfcRemoveBiasSer().
+ * 
+ *     NONE:    No fences. Cheapest; Reads may drift into or out of the region.
+ *     LFENCE:  lfence before and after. The default, used by PFCSTART/PFCEND.
+ *     MFENCE:  mfence+lfence before, lfence after. Also drains prior stores.
+ *     CPUID:   cpuid before and after. Fully serializing; Slowest.
+ *     RDTSCP:  rdtscp before, lfence after. rdtscp waits for all prior
+ *              instructions to execute, but not for stores to drain.
+ */
+
+#define PFC_SER_NONE    0
+#define PFC_SER_LFENCE  1
+#define PFC_SER_MFENCE  2
+#define PFC_SER_CPUID   3
+#define PFC_SER_RDTSCP  4
+
+#define _pfc_asm_pre_NONE     ""
+#define _pfc_asm_post_NONE    ""
+#define _pfc_asm_pre_LFENCE   "\n\tlfence                                  "
+#define _pfc_asm_post_LFENCE  "\n\tlfence                                  "
+#define _pfc_asm_pre_MFENCE   "\n\tmfence                                  " \
+                              "\n\tlfence                                  "
+#define _pfc_asm_post_MFENCE  "\n\tlfence                                  "
+#define _pfc_asm_pre_CPUID    "\n\txor      %%eax,   %%eax                 " \
+                              "\n\tcpuid                                   "
+#define _pfc_asm_post_CPUID   "\n\txor      %%eax,   %%eax                 " \
+                              "\n\tcpuid                                   "
+#define _pfc_asm_pre_RDTSCP   "\n\trdtscp                                  "
+#define _pfc_asm_post_RDTSCP  "\n\tlfence                                  "
+
+#define _pfc_clobbers_NONE    "memory", "rax",        "rcx", "rdx"
+#define _pfc_clobbers_LFENCE  "memory", "rax",        "rcx", "rdx"
+#define _pfc_clobbers_MFENCE  "memory", "rax",        "rcx", "rdx"
+#define _pfc_clobbers_CPUID   "memory", "rax", "rbx", "rcx", "rdx"
+#define _pfc_clobbers_RDTSCP  "memory", "rax",        "rcx", "rdx"
+
+#define _pfc_asm_code_ser_(op, pol)             \
+_pfc_asm_pre_##pol                              \
 _pfc_asm_code_cnt_read_(op, 0x40000000,  0)     \
 _pfc_asm_code_cnt_read_(op, 0x40000001,  8)     \
 _pfc_asm_code_cnt_read_(op, 0x40000002, 16)     \
@@ -109,16 +623,19 @@ _pfc_asm_code_cnt_read_(op, 0x00000000, 24)     \
 _pfc_asm_code_cnt_read_(op, 0x00000001, 32)     \
 _pfc_asm_code_cnt_read_(op, 0x00000002, 40)     \
 _pfc_asm_code_cnt_read_(op, 0x00000003, 48)     \
-"\n\tlfence                                  "  \
+_pfc_asm_post_##pol                             \
 
-#define _pfc_macro_(b, op)                      \
-asm volatile(                                   \
-_pfc_asm_code_(op)                              \
+#define _pfc_macro_ser_(b, op, pol)             \
+__asm__ __volatile__(                           \
+_pfc_asm_code_ser_(op, pol)                     \
 :        /* Outputs */                          \
 : "r"((b)) /* Inputs */                         \
-: "memory", "rax", "rcx", "rdx"                 \
+: _pfc_clobbers_##pol                           \
 )
 
+#define _pfc_asm_code_(op)   _pfc_asm_code_ser_(op, LFENCE)
+#define _pfc_macro_(b, op)   _pfc_macro_ser_((b), op, LFENCE)
+
 /**
  * The PFCSTART macro takes a single pointer to a 7-element array of 64-bit
  * integers and *subtracts* out of them the start counter values.
@@ -143,12 +660,247 @@ _pfc_asm_code_(op)                              \
 
 #define PFCEND(b)   _pfc_macro_((b), add)
 
+/**
+ * PFCSTART/PFCEND under an explicit serialization policy, given as one of the
+ * tokens NONE, LFENCE, MFENCE, CPUID or RDTSCP. Both ends of a region must
+ * use the same policy, and its bias removed with pfcRemoveBiasSer() and the
+ * matching PFC_SER_* constant:
+ * 
+ *     PFCSTART_SER(cnts, CPUID);
+ *     ...
+ *     PFCEND_SER  (cnts, CPUID);
+ *     pfcRemoveBiasSer(cnts, 1, PFC_SER_CPUID);
+ */
+
+#define PFCSTART_SER(b, pol) _pfc_macro_ser_((b), sub, pol)
+#define PFCEND_SER(b, pol)   _pfc_macro_ser_((b), add, pol)
+
+/**
+ * Syscall-free counter access.
+ * 
+ * Counters are selected by a bitmask over the 7 slots of the PFC_CNT array:
+ * bit k selects counter k, and its value goes to cnt[k]. The unselected
+ * elements of cnt are left untouched. With a constant selection, these
+ * compile down to one rdpmc per selected counter.
+ * 
+ * pfcSoftZero() snapshots the selected counters into a PFC_BASE, which
+ * pfcSoftRd() then subtracts out, modulo the counter bitwidth. This replaces
+ * pfcWrCnts() for zeroing whenever the hardware itself needs no reset. The
+ * PFC_BASE must have been set up once by pfcBaseInit() after pfcInit().
+ */
+
+#define PFC_SEL(k)      (1u << (k))
+#define PFC_SEL_FIXED   0x07u
+#define PFC_SEL_GP      0x78u
+#define PFC_SEL_ALL     0x7Fu
+
+typedef struct PFC_BASE{
+	PFC_CNT   cnt[7];
+	uint64_t  msk[7];
+} PFC_BASE;
+
+void      pfcBaseInit       (PFC_BASE* b);
+
+static inline PFC_CNT pfcRdpmc(int k){
+	uint32_t lo, hi;
+	__asm__ __volatile__("rdpmc" : "=a"(lo), "=d"(hi) : "c"(k < 3 ? 0x40000000u|k : (uint32_t)k-3));
+	return (PFC_CNT)((uint64_t)hi << 32 | lo);
+}
+#define _pfc_rdpmc_sel_(k)                                          \
+	if(sel & PFC_SEL(k)){cnt[k] = pfcRdpmc(k);}
+#define _pfc_softrd_sel_(k)                                         \
+	if(sel & PFC_SEL(k)){cnt[k] = (pfcRdpmc(k) - b->cnt[k]) & b->msk[k];}
+
+static inline void    pfcRdpmcCnts(uint32_t sel, PFC_CNT* cnt){
+	_pfc_rdpmc_sel_(0) _pfc_rdpmc_sel_(1) _pfc_rdpmc_sel_(2)
+	_pfc_rdpmc_sel_(3) _pfc_rdpmc_sel_(4) _pfc_rdpmc_sel_(5) _pfc_rdpmc_sel_(6)
+}
+static inline void    pfcSoftZero (PFC_BASE* b, uint32_t sel){
+	pfcRdpmcCnts(sel, b->cnt);
+}
+static inline void    pfcSoftRd   (const PFC_BASE* b, uint32_t sel, PFC_CNT* cnt){
+	_pfc_softrd_sel_(0) _pfc_softrd_sel_(1) _pfc_softrd_sel_(2)
+	_pfc_softrd_sel_(3) _pfc_softrd_sel_(4) _pfc_softrd_sel_(5) _pfc_softrd_sel_(6)
+}
+#undef _pfc_rdpmc_sel_
+#undef _pfc_softrd_sel_
+
 /**
  * Remove mul times from b the counter bias due to PFCSTART/PFCEND.
  */
 
 void      pfcRemoveBias     (PFC_CNT* b, int64_t mul);
 
+/**
+ * Same as pfcRemoveBias(), for PFCSTART_SER/PFCEND_SER under policy pol, one
+ * of the PFC_SER_* constants.
+ */
+
+void      pfcRemoveBiasSer  (PFC_CNT* b, int64_t mul, int pol);
+
+/**
+ * Sampled instrumentation.
+ *
+ * PFCSTART_SAMPLED/PFCEND_SAMPLED bracket a region like PFCSTART/PFCEND, but
+ * only read the counters on a pseudo-random 1-in-N basis; Otherwise they
+ * cost a decrement and an untaken branch. The gap to the next sample is drawn
+ * uniformly from [1, 2N-1], so that sampling does not alias with periodic
+ * workloads.
+ *
+ * After every sample, pfcSamplerUpdate() removes the PFCSTART/PFCEND bias
+ * from it, accumulates it, and retunes N so that the cycles spent reading
+ * counters stay under budget (a fraction, e.g. 0.005) of the cycles spent in
+ * the regions themselves. This needs fixed counter 1 (core cycles) enabled;
+ * Without it N stays put.
+ *
+ * A PFC_SAMPLER is not thread-safe; Give each thread its own, e.g.
+ *
+ *     static __thread PFC_SAMPLER s;
+ *     if(!s.period){pfcSamplerInit(&s, 0.005);}
+ *     PFCSTART_SAMPLED(&s);
+ *     ...
+ *     PFCEND_SAMPLED(&s);
+ *
+ * pfcSamplerInit() measures the bias, so call it after configuring the
+ * counters. pfcSamplerEstimate() fills est[0..6] with the sampled counts
+ * scaled up to all regions entered so far, and returns how many those are.
+ */
+
+typedef struct PFC_SAMPLER{
+	/* Hot path */
+	uint32_t  countdown;   /* Regions left until the next sample */
+	uint32_t  active;      /* Current region is being sampled */
+	PFC_CNT   tmp[7];      /* PFCSTART/PFCEND buffer of current sample */
+
+	/* Controller */
+	uint32_t  period;      /* Current N */
+	uint32_t  minPeriod;
+	uint32_t  maxPeriod;
+	double    budget;      /* Target overhead, as a fraction of region cycles */
+	double    overhead;    /* Estimated overhead so far, same units */
+	uint64_t  rng;         /* xorshift64 state */
+
+	/* Accumulators */
+	uint64_t  drawn;       /* Regions covered by all gaps drawn so far */
+	uint64_t  samples;     /* Regions sampled */
+	PFC_CNT   sum[7];      /* Unbiased counts summed over sampled regions */
+	PFC_CNT   bias[7];
+	uint64_t  msk[7];
+} PFC_SAMPLER;
+
+void      pfcSamplerInit    (PFC_SAMPLER* s, double budget);
+void      pfcSamplerUpdate  (PFC_SAMPLER* s);
+uint64_t  pfcSamplerEstimate(const PFC_SAMPLER* s, double* est);
+
+#define PFCSTART_SAMPLED(s) do{                             \
+	if(__builtin_expect(--(s)->countdown == 0, 0)){         \
+		(s)->active = 1;                                    \
+		PFCSTART((s)->tmp);                                 \
+	}                                                       \
+}while(0)
+#define PFCEND_SAMPLED(s)   do{                             \
+	if(__builtin_expect((s)->active, 0)){                   \
+		PFCEND((s)->tmp);                                   \
+		pfcSamplerUpdate((s));                              \
+	}                                                       \
+}while(0)
+
+/**
+ * Task-aware accumulation.
+ *
+ * A PFC_TASK accumulates counts only over the intervals during which a
+ * logical task (request, coroutine, ...) actually ran, between
+ * pfcTaskResume() and pfcTaskSuspend(), whatever thread or CPU it ran on.
+ * Call both from the thread that runs the task, around each run slice.
+ *
+ * Each interval is checked on suspend: If the thread moved to another CPU
+ * while running, or the CPU's configuration signature (see
+ * pfcCfgSignature()) is unknown or differs from that of the task's first
+ * interval, its counts are meaningless and it is discarded. So program all
+ * CPUs the task may run on with pfcWrCfgsAll() first.
+ *
+ * Every accepted interval carries one PFCSTART/PFCEND bias; Remove it with
+ * pfcRemoveBias(t->cnt, t->intervals).
+ */
+
+typedef struct PFC_TASK{
+	PFC_CNT   cnt[7];      /* Counts over accepted intervals */
+	PFC_CNT   tmp[7];      /* PFCSTART/PFCEND buffer of the current interval */
+	uint64_t  msk[7];
+	uint64_t  sig;         /* Configuration signature the counts belong to */
+	uint32_t  cpu;         /* CPU at the last resume */
+	uint64_t  intervals;   /* Accepted */
+	uint64_t  migrated;    /* Discarded: CPU changed while running */
+	uint64_t  mismatched;  /* Discarded: CPU configured differently */
+} PFC_TASK;
+
+void      pfcTaskInit       (PFC_TASK* t);
+void      pfcTaskAccount    (PFC_TASK* t, uint32_t cpu);
+
+/**
+ * Current CPU from IA32_TSC_AUX, which Linux sets to (node << 12) | cpu.
+ */
+
+static inline uint32_t pfcRdCpu(void){
+	uint32_t lo, hi, aux;
+	__asm__ __volatile__("rdtscp" : "=a"(lo), "=d"(hi), "=c"(aux));
+	(void)lo; (void)hi;
+	return aux & 0xFFF;
+}
+static inline void     pfcTaskResume (PFC_TASK* t){
+	t->cpu = pfcRdCpu();
+	PFCSTART(t->tmp);
+}
+static inline void     pfcTaskSuspend(PFC_TASK* t){
+	PFCEND(t->tmp);
+	pfcTaskAccount(t, pfcRdCpu());
+}
+
+/**
+ * Validated measurements.
+ *
+ * pfcValidInit() dedicates general-purpose counter k (3 to 6) of the calling
+ * thread's CPU to *cpl_cycles.ring0>=1:uk, which counts entries into the
+ * kernel. With PFC_VALID_THROTTLED in flags, MSR_CORE_PERF_LIMIT_REASONS is
+ * also sampled around each region, at the cost of a syscall on each side.
+ * Bracket each PFCSTART/PFCEND region with pfcValidBegin() and pfcValidEnd():
+ *
+ *     pfcValidBegin(&v);
+ *     PFCSTART(cnt);
+ *     ...
+ *     PFCEND(cnt);
+ *     tag = pfcValidEnd(&v, cnt);
+ *
+ * The tag is PFC_VALID_CLEAN, or an OR of PFC_VALID_PREEMPTED (the kernel
+ * was entered: interrupt, fault, syscall or preemption), PFC_VALID_MIGRATED
+ * (TSC_AUX CPU changed) and PFC_VALID_THROTTLED (a frequency limit was
+ * logged). v->n counts clean samples and samples per reason. Feed tags to
+ * pfcStatsValid() to drop tainted samples.
+ */
+
+#define PFC_VALID_CLEAN         0x0
+#define PFC_VALID_PREEMPTED     0x1
+#define PFC_VALID_MIGRATED      0x2
+#define PFC_VALID_THROTTLED     0x4
+
+typedef struct PFC_VALID{
+	int       k;           /* Counter of *cpl_cycles.ring0>=1:uk */
+	int       throttle;    /* Whether limit reasons are sampled */
+	uint32_t  cpu;         /* CPU at the last pfcValidBegin() */
+	uint64_t  reasons;     /* Limit reasons at the last read */
+	uint64_t  n[4];        /* Clean, preempted, migrated, throttled */
+} PFC_VALID;
+
+int       pfcValidInit      (PFC_VALID* v, int k, int flags);
+int       pfcValidEnd       (PFC_VALID* v, const PFC_CNT* cnt);
+
+static inline void     pfcValidBegin (PFC_VALID* v){
+	if(v->throttle){
+		pfcRdMSR(MSR_CORE_PERF_LIMIT_REASONS, &v->reasons);
+	}
+	v->cpu = pfcRdCpu();
+}
+
 /**
  * Return a string representation of a libpfc error code, such as the one
  * returned by pfcInit().
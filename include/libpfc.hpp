@@ -0,0 +1,469 @@
+/* Include Guards */
+#ifndef LIBPFC_HPP
+#define LIBPFC_HPP
+
+
+/* Includes */
+#include "libpfc.h"
+
+
+
+/**
+ * C++ interface to libpfc.
+ *
+ * Header-only, heap-free wrappers over the C API whose counter assignment is
+ * resolved entirely at compile time.
+ */
+
+namespace pfc{
+
+/* Event descriptors */
+
+/**
+ * A fixed-function counter event. K is its position in the PFC_CNT array,
+ * and is also the counter it is read from.
+ */
+
+template<int K>
+struct Fixed{
+	static constexpr int     counter = K;
+	static constexpr PFC_CFG cfg     = 2;
+};
+
+typedef Fixed<PFC_FIXEDCNT_INSTRUCTIONS_RETIRED> Instructions;
+typedef Fixed<PFC_FIXEDCNT_CPU_CLK_UNHALTED>     Cycles;
+typedef Fixed<PFC_FIXEDCNT_CPU_CLK_REF_TSC>      RefCycles;
+
+/**
+ * A general-purpose counter event, given as the PFC_CFG value pfcParseCfg()
+ * would return for it. The counter is assigned by position: the n'th Event<>
+ * of a Scope is read from general-purpose counter n (PFC_CNT slot 3+n).
+ */
+
+template<PFC_CFG C>
+struct Event{
+	static constexpr int     counter = -1;
+	static constexpr PFC_CFG cfg     = C;
+};
+
+
+/* Implementation details */
+namespace detail{
+
+/**
+ * Population count, for duplicate detection.
+ */
+
+constexpr int popcount(unsigned v){
+	return v ? (int)(v&1) + popcount(v>>1) : 0;
+}
+
+/**
+ * Index of event Ev within the list E...; Fails to compile if absent.
+ */
+
+template<typename Ev, typename... E> struct IndexOf;
+template<typename Ev, typename... T>
+struct IndexOf<Ev, Ev, T...>{
+	static constexpr int value = 0;
+};
+template<typename Ev, typename H, typename... T>
+struct IndexOf<Ev, H, T...>{
+	static constexpr int value = 1 + IndexOf<Ev, T...>::value;
+};
+
+/**
+ * Compile-time walk over the event list. Slot is the event's position in the
+ * accumulator; Gp the number of general-purpose events before it.
+ *
+ * Every member function is a chain of inlined calls that boils down to one
+ * rdpmc per event with a constant counter number.
+ */
+
+template<int Slot, int Gp, typename... E>
+struct Ops{
+	static constexpr int      numGp     = Gp;
+	static constexpr unsigned fixedMask = 0;
+	static constexpr int      numFixed  = 0;
+	static inline void start    (PFC_CNT*){}
+	static inline void end      (PFC_CNT*){}
+	static inline int  configure(void){return 0;}
+	static inline void mask     (PFC_CNT*, const uint64_t*){}
+};
+template<int Slot, int Gp, typename H, typename... T>
+struct Ops<Slot, Gp, H, T...>{
+	static constexpr bool     isGp      = H::counter < 0;
+	static constexpr int      counter   = isGp ? 3+Gp : H::counter;
+	typedef Ops<Slot+1, Gp+(isGp ? 1 : 0), T...> Next;
+	static constexpr int      numGp     = Next::numGp;
+	static constexpr unsigned fixedMask = (isGp ? 0u : 1u << counter) | Next::fixedMask;
+	static constexpr int      numFixed  = (isGp ? 0  : 1)             + Next::numFixed;
+
+	static inline void start    (PFC_CNT* acc){
+		acc[Slot] -= pfcRdpmc(counter);
+		Next::start(acc);
+	}
+	static inline void end      (PFC_CNT* acc){
+		acc[Slot] += pfcRdpmc(counter);
+		Next::end(acc);
+	}
+	static inline int  configure(void){
+		PFC_CFG cfg = H::cfg;
+		int     ret = pfcWrCfgs(counter, 1, &cfg);
+		return ret ? ret : Next::configure();
+	}
+	static inline void mask     (PFC_CNT* acc, const uint64_t* msk){
+		acc[Slot] &= msk[counter];
+		Next::mask(acc, msk);
+	}
+};
+
+}/* End namespace detail */
+
+
+/**
+ * Accumulator of counts for the events E..., in that order.
+ */
+
+template<typename... E>
+struct Counts{
+	static_assert(sizeof...(E) > 0, "pfc::Counts needs at least one event.");
+
+	PFC_CNT v[sizeof...(E)];
+
+	Counts(){clear();}
+	void           clear     (void){for(PFC_CNT& x : v){x = 0;}}
+	PFC_CNT&       operator[](int i)      {return v[i];}
+	const PFC_CNT& operator[](int i) const{return v[i];}
+	template<typename Ev>
+	PFC_CNT&       get       (void)       {return v[detail::IndexOf<Ev, E...>::value];}
+	template<typename Ev>
+	const PFC_CNT& get       (void) const {return v[detail::IndexOf<Ev, E...>::value];}
+};
+
+
+/**
+ * RAII counter scope over the events E...
+ *
+ * The constructor reads exactly the counters of E... and subtracts them out
+ * of the accumulator; The destructor reads them again and adds them in. As
+ * with PFCSTART/PFCEND, the accumulator thus gathers (biased) deltas over all
+ * scopes, and the bias can be removed with removeBias().
+ *
+ *     typedef pfc::Scope<pfc::Instructions, pfc::Cycles, pfc::Event<CFG>> S;
+ *     S::configure();
+ *     S::Accumulator acc;
+ *     for(...){
+ *         S s(acc);
+ *         work();
+ *     }
+ *     S::removeBias(acc, n);
+ *     acc.get<pfc::Cycles>();
+ */
+
+template<typename... E>
+class Scope{
+	typedef detail::Ops<0, 0, E...> Ops;
+
+	static_assert(sizeof...(E) > 0,
+	              "pfc::Scope needs at least one event.");
+	static_assert(Ops::numGp <= 4,
+	              "pfc::Scope supports at most 4 general-purpose events.");
+	static_assert(detail::popcount(Ops::fixedMask) == Ops::numFixed,
+	              "pfc::Scope lists a fixed-function event more than once.");
+
+	public:
+	typedef Counts<E...> Accumulator;
+
+	explicit inline Scope(Accumulator& acc) : acc(acc){
+		asm volatile("lfence" ::: "memory");
+		Ops::start(acc.v);
+		asm volatile("lfence" ::: "memory");
+	}
+	inline ~Scope(){
+		asm volatile("lfence" ::: "memory");
+		Ops::end(acc.v);
+		asm volatile("lfence" ::: "memory");
+	}
+	Scope(const Scope&)            = delete;
+	Scope& operator=(const Scope&) = delete;
+
+	/**
+	 * Write the configurations of E..., and only those, to their counters.
+	 * Returns 0 on success or a PFC_ERR_* code.
+	 */
+
+	static int  configure (void){
+		return Ops::configure();
+	}
+
+	/**
+	 * Remove from acc mul times the bias of one Scope construction and
+	 * destruction, measured with the current counter configuration.
+	 */
+
+	static void removeBias(Accumulator& acc, int64_t mul){
+		Accumulator warmup;
+		uint64_t    msk[7];
+		int         i;
+
+		for(i=0;i<10;i++){
+			warmup.clear();
+			{Scope s(warmup);}
+		}
+		pfcRdMasks(0, 7, msk);
+		for(i=0;i<(int)sizeof...(E);i++){
+			acc[i] -= warmup[i]*mul;
+		}
+		Ops::mask(acc.v, msk);
+	}
+
+	private:
+	Accumulator& acc;
+};
+
+
+/**
+ * RAII run slice of a PFC_TASK: Resumes it on construction and suspends it on
+ * destruction. For coroutines, wrap each resumption in the scheduler:
+ *
+ *     {
+ *         pfc::TaskRun r(req->task);
+ *         req->handle.resume();
+ *     }
+ */
+
+class TaskRun{
+	public:
+	explicit inline TaskRun(PFC_TASK& t) : t(t){pfcTaskResume (&t);}
+	inline ~TaskRun()                          {pfcTaskSuspend(&t);}
+	TaskRun(const TaskRun&)            = delete;
+	TaskRun& operator=(const TaskRun&) = delete;
+
+	private:
+	PFC_TASK& t;
+};
+
+}/* End namespace pfc */
+
+
+
+/**
+ * Compile-time configuration parser (C++17).
+ */
+
+#if __cplusplus >= 201703L
+#include "libpfcevt.h"
+#include <stdexcept>
+#include <type_traits>
+
+namespace pfc{
+
+/* Implementation details */
+namespace detail{
+
+constexpr char     lower      (char c){
+	return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+constexpr bool     isDigit    (char c){
+	return c >= '0' && c <= '9';
+}
+constexpr int      digitVal   (char c){
+	return c >= '0' && c <= '9' ? c - '0'      :
+	       c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+	       c >= 'A' && c <= 'F' ? c - 'A' + 10 : 16;
+}
+
+/**
+ * Case-insensitive length of the name that s starts with, or -1 if it does
+ * not start with name.
+ */
+
+constexpr int      prefixLen  (const char* s, const char* name){
+	int n = 0;
+	for(;name[n];n++){
+		if(lower(s[n]) != lower(name[n])){
+			return -1;
+		}
+	}
+	return n;
+}
+
+/**
+ * Whether s points at something that may follow a umask: end of string,
+ * a cmask, the mode bits or an offcore response.
+ */
+
+constexpr bool     isUmaskEnd (const char* s){
+	return s[0] == '\0' || s[0] == '<' || (s[0] == '>' && s[1] == '=') || s[0] == ':' || s[0] == '@';
+}
+
+/**
+ * strtoull(s, &s, 0): Decimal, 0x-prefixed hexadecimal or 0-prefixed octal.
+ * If there are no digits, s is left unchanged and 0 is returned.
+ */
+
+constexpr uint64_t parseUint  (const char*& s){
+	uint64_t v    = 0;
+	int      base = 10;
+
+	if(s[0] == '0' && lower(s[1]) == 'x' && digitVal(s[2]) < 16){
+		base = 16;
+		s   += 2;
+	}else if(s[0] == '0'){
+		base = 8;
+	}
+	for(;digitVal(*s) < base;s++){
+		v = v*base + digitVal(*s);
+	}
+	return v;
+}
+
+}/* End namespace detail */
+
+
+/**
+ * constexpr equivalent of pfcParseCfg(), over the same event tables.
+ *
+ * Where pfcParseCfg() returns 0 for a string it cannot make sense of, this
+ * throws std::invalid_argument, which in a constant expression is a compile
+ * error. It is also stricter: Trailing characters and cmasks over 255 are
+ * rejected instead of being ignored or truncated. An "@response" suffix is
+ * left to pfcParseOffcore() at runtime.
+ *
+ * Use it in a constexpr context (or through PFC_CFG_CONST()) to be sure the
+ * parse happens at compile time:
+ *
+ *     constexpr PFC_CFG CFG = pfc::parseCfg("uops_issued.any:uk");
+ *     typedef pfc::Scope<pfc::Event<pfc::parseCfg("*cpl_cycles.ring0>=1:uk")>> S;
+ */
+
+constexpr PFC_CFG parseCfg(const char* s){
+	uint64_t         edgeTriggered = 0,
+	                 evtNum        = 0,
+	                 umaskVal      = 0,
+	                 user          = 1,
+	                 os            = 0,
+	                 anythread     = 0,
+	                 inv           = 0,
+	                 cmask         = 0;
+	int              i             = 0, n = -1;
+	const PFC_UMASK* umaskList     = nullptr;
+	const char*      p             = nullptr;
+
+
+	/* Null configs result in disabled counter. */
+	if(!s || s[0] == '\0'){
+		return 0;
+	}
+
+	/* Is it edge triggered? */
+	if(s[0] == '*'){
+		edgeTriggered = 1;
+		s++;
+	}
+
+	/* Find event number and umask list, by name or else by number. */
+	for(i=0;PFC_EVENT_LIST[i].name;i++){
+		n = detail::prefixLen(s, PFC_EVENT_LIST[i].name);
+		if(n >= 0 && s[n] == '.'){
+			evtNum    = PFC_EVENT_LIST[i].evtNum;
+			umaskList = PFC_EVENT_LIST[i].umasks;
+			s        += n+1;
+			break;
+		}
+	}
+	if(!umaskList){
+		p      = s;
+		evtNum = detail::parseUint(s);
+		if(s == p || s[0] != '.' || evtNum > 0xFF){
+			throw std::invalid_argument("pfc::parseCfg: Unknown event name");
+		}
+		s++;
+
+		for(i=0;PFC_EVENT_LIST[i].name;i++){
+			if(PFC_EVENT_LIST[i].evtNum == evtNum){
+				umaskList = PFC_EVENT_LIST[i].umasks;
+				break;
+			}
+		}
+		if(!umaskList){
+			throw std::invalid_argument("pfc::parseCfg: Unknown event number");
+		}
+	}
+
+	/* Find umask value, by name or else by number. */
+	for(i=0;umaskList[i].name;i++){
+		n = detail::prefixLen(s, umaskList[i].name);
+		if(n >= 0 && detail::isUmaskEnd(s+n)){
+			umaskVal = umaskList[i].umaskVal;
+			s       += n;
+			break;
+		}
+	}
+	if(!umaskList[i].name){
+		p        = s;
+		umaskVal = detail::parseUint(s);
+		if(s == p || umaskVal > 0xFF || !detail::isUmaskEnd(s)){
+			throw std::invalid_argument("pfc::parseCfg: Unknown umask");
+		}
+	}
+
+	/* Parse comparison sign and cmask if available. */
+	if(s[0] == '>' && s[1] == '=' && detail::isDigit(s[2])){
+		s    += 2;
+		inv   = 0;
+		cmask = detail::parseUint(s);
+	}else if(s[0] == '<' && detail::isDigit(s[1])){
+		s    += 1;
+		inv   = 1;
+		cmask = detail::parseUint(s);
+	}
+	if(cmask > 0xFF){
+		throw std::invalid_argument("pfc::parseCfg: cmask out of range");
+	}
+
+	/* Parse mode bits if available. */
+	if(s[0] == ':'){
+		anythread = user = os = 0;
+		for(s++;*s && *s != '@';s++){
+			switch(*s){
+				case 'A':
+				case 'a': anythread = 1;break;
+				case 'U':
+				case 'u': user      = 1;break;
+				case 'K':
+				case 'k': os        = 1;break;
+				default : throw std::invalid_argument("pfc::parseCfg: Unknown mode bit");
+			}
+		}
+	}
+	if(*s && *s != '@'){
+		throw std::invalid_argument("pfc::parseCfg: Trailing characters");
+	}
+
+	/* At last, assemble the pieces. */
+	return (cmask         << 24) |
+	       (inv           << 23) |
+	       (1ULL          << 22) |
+	       (anythread     << 21) |
+	       (edgeTriggered << 18) |
+	       (os            << 17) |
+	       (user          << 16) |
+	       (umaskVal      <<  8) |
+	       (evtNum        <<  0);
+}
+
+}/* End namespace pfc */
+
+/**
+ * The configuration for event string s, guaranteed to be computed at compile
+ * time. A misspelled event is a compile error.
+ */
+
+#define PFC_CFG_CONST(s) (std::integral_constant<PFC_CFG, pfc::parseCfg(s)>::value)
+
+#endif
+
+
+#endif /* End Include Guards */
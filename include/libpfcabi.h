@@ -0,0 +1,102 @@
+/* Include Guards */
+#ifndef LIBPFCABI_H
+#define LIBPFCABI_H
+
+
+
+/**
+ * Layout of the pfc.ko sysfs files under /sys/module/pfc/, shared between the
+ * kernel module and libpfc.
+ *
+ * Like libpfcmsr.h, this header must remain includable from kernel code:
+ * Defines only.
+ */
+
+/**
+ * Maximum number of PMCs (fixed-function and general-purpose combined). The
+ * config, masks and counts files hold one 64-bit word per PMC, fixed-function
+ * first.
+ */
+
+#define PFC_ABI_MAXPMC                     25
+
+/**
+ * Configuration slots.
+ *
+ *     slots:  PFC_ABI_NSLOTS consecutive arrays of PFC_ABI_MAXPMC 64-bit
+ *             configurations, laid out as in the config file. Writes go to
+ *             the slot tables of all CPUs; Reads come from the calling CPU's.
+ *     slot:   One 64-bit word. Writing a slot number switches the calling CPU
+ *             to that slot; Reading returns the calling CPU's current slot,
+ *             or PFC_ABI_NOSLOT.
+ */
+
+#define PFC_ABI_NSLOTS                     8
+#define PFC_ABI_NOSLOT                     (~0ULL)
+
+/**
+ * Multiplexing.
+ *
+ * mux:    Writing two 64-bit words {G, period in ns} rotates the counters of
+ *         every online CPU through slots 0 to G-1, one slot per period;
+ *         Writing G = 0 stops. Reading returns a header of PFC_ABI_MUX_HDR
+ *         words {G, period in ns, enabled time in ns}, followed by one row of
+ *         PFC_ABI_MUX_STRIDE words per slot {running time in ns, counts of
+ *         the PFC_ABI_MAXPMC counters}. Times and counts are summed over all
+ *         CPUs since the last start, so that a count scales to the whole run
+ *         as count*enabled/running.
+ */
+
+#define PFC_ABI_MUX_HDR                    3
+#define PFC_ABI_MUX_STRIDE                 (1+PFC_ABI_MAXPMC)
+#define PFC_ABI_MUX_SIZE                   (PFC_ABI_MUX_HDR+PFC_ABI_NSLOTS*PFC_ABI_MUX_STRIDE)
+#define PFC_ABI_MUX_MINPERIOD              100000
+
+/**
+ * Time series rings.
+ *
+ * ring:   Text. Writing "<period in ns> <cpulist>" samples the TSC and the
+ *         counters of the listed CPUs every period, on a kernel timer pinned
+ *         to each; Writing "0" stops. Reading returns the same.
+ * rings:  mmap() only, read-only. The ring of CPU c spans PFC_ABI_RING_BYTES
+ *         bytes from offset c*PFC_ABI_RING_BYTES: A header page of 64-bit
+ *         words indexed by PFC_ABI_RING_HEAD and PFC_ABI_RING_PERIOD, then
+ *         PFC_ABI_RING_NREC records of PFC_ABI_RING_RECW 64-bit words.
+ *
+ * Record n (counting from 1) goes to index (n-1) % PFC_ABI_RING_NREC. Its seq
+ * word is 0 while it is being written and n once complete, after which the
+ * header's head word becomes n. A reader of record n reads seq, the record,
+ * then seq again, and keeps it only if both equal n. Counts are those of the
+ * first PFC_ABI_RING_NCNT counters, masked, laid out as in the config file.
+ */
+
+#define PFC_ABI_RING_NREC                  1024
+#define PFC_ABI_RING_RECW                  16
+#define PFC_ABI_RING_NCNT                  (PFC_ABI_RING_RECW-2)
+#define PFC_ABI_RING_HDRW                  512
+#define PFC_ABI_RING_BYTES                 (8*(PFC_ABI_RING_HDRW+PFC_ABI_RING_NREC*PFC_ABI_RING_RECW))
+#define PFC_ABI_RING_MINPERIOD             100000
+#define PFC_ABI_RING_HEAD                  0       /* Header: Last record written */
+#define PFC_ABI_RING_PERIOD                1       /* Header: Period in ns, 0 if stopped */
+#define PFC_ABI_RING_SEQ                   0       /* Record: Sequence number */
+#define PFC_ABI_RING_TSC                   1       /* Record: TSC */
+#define PFC_ABI_RING_CNT                   2       /* Record: Counts */
+
+/**
+ * Remote counts.
+ *
+ * remote: Read-only. The counts of CPU c are the PFC_ABI_REMOTE_NCNT 64-bit
+ *         words at offset c*PFC_ABI_REMOTE_STRIDE, laid out as in the counts
+ *         file. All online CPUs a read covers are interrupted together, each
+ *         to read its own counters. sysfs returns at most a page per read,
+ *         so at most PFC_ABI_REMOTE_WINDOW bytes' worth of CPUs (64) are
+ *         snapshotted together.
+ */
+
+#define PFC_ABI_REMOTE_NCNT                8
+#define PFC_ABI_REMOTE_STRIDE              (8*PFC_ABI_REMOTE_NCNT)
+#define PFC_ABI_REMOTE_WINDOW              4096
+
+
+
+#endif /* End Include Guards */
@@ -32,6 +32,12 @@
 #ifndef MSR_IA32_MISC_ENABLE
 #define MSR_IA32_MISC_ENABLE               0x1A0
 #endif
+#ifndef MSR_OFFCORE_RSP_0
+#define MSR_OFFCORE_RSP_0                  0x1A6
+#endif
+#ifndef MSR_OFFCORE_RSP_1
+#define MSR_OFFCORE_RSP_1                  0x1A7
+#endif
 #ifndef MSR_IA32_TEMPERATURE_TARGET
 #define MSR_IA32_TEMPERATURE_TARGET        0x1A2
 #endif
@@ -44,6 +50,9 @@
 #ifndef MSR_IA32_PACKAGE_THERM_INTERRUPT
 #define MSR_IA32_PACKAGE_THERM_INTERRUPT   0x1B2
 #endif
+#ifndef MSR_IA32_DEBUGCTL
+#define MSR_IA32_DEBUGCTL                  0x1D9
+#endif
 #ifndef MSR_IA32_FIXED_CTR0
 #define MSR_IA32_FIXED_CTR0                0x309
 #endif
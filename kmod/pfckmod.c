@@ -1,11 +1,20 @@
 /* Includes */
 #include <asm/processor.h>
 #include <asm/msr.h>
+#include <linux/hrtimer.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include <linux/sysfs.h>
 #include <linux/smp.h>
+#include <linux/version.h>
+#include "libpfcabi.h"
 #include "libpfcmsr.h"
 
 
@@ -15,7 +24,7 @@
  * Maximum number of PMCs (fixed-function and general-purpose combined)
  */
 
-#define MAXPMC                             25
+#define MAXPMC                             PFC_ABI_MAXPMC
 
 /**
  * Conditional logging.
@@ -27,6 +36,16 @@
 /* Data Structure Typedefs */
 struct CPUID_LEAF;
 typedef struct CPUID_LEAF CPUID_LEAF;
+struct PFC_SLOTS;
+typedef struct PFC_SLOTS  PFC_SLOTS;
+struct PFC_MUXTOT;
+typedef struct PFC_MUXTOT PFC_MUXTOT;
+struct PFC_MUXCPU;
+typedef struct PFC_MUXCPU PFC_MUXCPU;
+struct PFC_RINGCPU;
+typedef struct PFC_RINGCPU PFC_RINGCPU;
+struct PFC_REMOTE;
+typedef struct PFC_REMOTE PFC_REMOTE;
 
 
 /* Data Structure Definitions */
@@ -34,6 +53,64 @@ struct CPUID_LEAF{
 	uint32_t a, b, c, d;
 };
 
+/**
+ * Per-CPU preloaded configuration slots, and the slot the CPU's counters were
+ * last programmed from (PFC_ABI_NOSLOT if none, or if they were reconfigured
+ * through the config file since).
+ */
+
+struct PFC_SLOTS{
+	uint64_t cfg[PFC_ABI_NSLOTS][MAXPMC];
+	uint64_t cur;
+};
+
+/**
+ * Multiplexing totals: Time each slot spent programmed into the counters, and
+ * the 64-bit sum of the counts it accumulated meanwhile.
+ */
+
+struct PFC_MUXTOT{
+	uint64_t running[PFC_ABI_NSLOTS];
+	uint64_t counts [PFC_ABI_NSLOTS][MAXPMC];
+};
+
+/**
+ * Per-CPU multiplexing state. The timer rotates through slots 0 to groups-1;
+ * The group currently programmed was switched in at time since (ns). snap is
+ * a consistent copy of tot, taken on the CPU itself for readers.
+ */
+
+struct PFC_MUXCPU{
+	struct hrtimer timer;
+	int            on;
+	int            groups;
+	int            group;
+	uint64_t       period;
+	uint64_t       start;
+	uint64_t       since;
+	PFC_MUXTOT     tot;
+	PFC_MUXTOT     snap;
+};
+
+/**
+ * Per-CPU time series sampling state.
+ */
+
+struct PFC_RINGCPU{
+	struct hrtimer timer;
+	int            on;
+	uint64_t       period;
+};
+
+/**
+ * Remote read request: Counts of CPUs first and up, one row each.
+ */
+
+struct PFC_REMOTE{
+	uint64_t* img;
+	int       first;
+};
+
 
 /* Forward Declarations */
 static ssize_t pfcCfgRd(struct file*          f,
@@ -72,6 +149,70 @@ static ssize_t pfcMsrRd (struct file*          f,
                          char*                 buf,
                          loff_t                off,
                          size_t                len);
+static ssize_t pfcMsrWr (struct file*          f,
+                         struct kobject*       kobj,
+                         struct bin_attribute* binattr,
+                         char*                 buf,
+                         loff_t                off,
+                         size_t                len);
+static ssize_t pfcSlotsRd(struct file*          f,
+                          struct kobject*       kobj,
+                          struct bin_attribute* binattr,
+                          char*                 buf,
+                          loff_t                off,
+                          size_t                len);
+static ssize_t pfcSlotsWr(struct file*          f,
+                          struct kobject*       kobj,
+                          struct bin_attribute* binattr,
+                          char*                 buf,
+                          loff_t                off,
+                          size_t                len);
+static ssize_t pfcSlotRd (struct file*          f,
+                          struct kobject*       kobj,
+                          struct bin_attribute* binattr,
+                          char*                 buf,
+                          loff_t                off,
+                          size_t                len);
+static ssize_t pfcSlotWr (struct file*          f,
+                          struct kobject*       kobj,
+                          struct bin_attribute* binattr,
+                          char*                 buf,
+                          loff_t                off,
+                          size_t                len);
+static ssize_t pfcMuxRd  (struct file*          f,
+                          struct kobject*       kobj,
+                          struct bin_attribute* binattr,
+                          char*                 buf,
+                          loff_t                off,
+                          size_t                len);
+static ssize_t pfcMuxWr  (struct file*          f,
+                          struct kobject*       kobj,
+                          struct bin_attribute* binattr,
+                          char*                 buf,
+                          loff_t                off,
+                          size_t                len);
+static ssize_t pfcRemoteRd(struct file*          f,
+                           struct kobject*       kobj,
+                           struct bin_attribute* binattr,
+                           char*                 buf,
+                           loff_t                off,
+                           size_t                len);
+static ssize_t pfcOffcoreRd(struct file*          f,
+                            struct kobject*       kobj,
+                            struct bin_attribute* binattr,
+                            char*                 buf,
+                            loff_t                off,
+                            size_t                len);
+static ssize_t pfcOffcoreWr(struct file*          f,
+                            struct kobject*       kobj,
+                            struct bin_attribute* binattr,
+                            char*                 buf,
+                            loff_t                off,
+                            size_t                len);
+static int     pfcRingsMmap(struct file*           f,
+                            struct kobject*        kobj,
+                            struct bin_attribute*  binattr,
+                            struct vm_area_struct* vma);
 static ssize_t pfcVerboseRd(struct kobject*        kobj,
                             struct kobj_attribute* attr,
                             char*                  buf);
@@ -82,6 +223,13 @@ static ssize_t pfcVerboseWr(struct kobject*        kobj,
 static ssize_t pfcCR4PceRd(struct kobject*         kobj,
                            struct kobj_attribute*  attr,
                            char*                   buf);
+static ssize_t pfcRingRd  (struct kobject*         kobj,
+                           struct kobj_attribute*  attr,
+                           char*                   buf);
+static ssize_t pfcRingWr  (struct kobject*         kobj,
+                           struct kobj_attribute*  attr,
+                           const char*             buf,
+                           size_t                  count);
 static int  __init pfcInit(void);
 static void        pfcExit(void);
 
@@ -119,7 +267,22 @@ static int        pmcEndFf             = 0;
 static int        pmcStartGp           = 0;
 static int        pmcEndGp             = 0;
 static int        fullWidthWrites      = 0;
+static int        freezeWhileSmm       = 0; /* IA32_PERF_CAPABILITIES[12] */
+static uint64_t   offcoreRsvd          = 0; /* Reserved bits of MSR_OFFCORE_RSP_x, 0 if absent */
 static int        verbose              = 0;
+static DEFINE_PER_CPU(PFC_SLOTS, pfcSlots);
+static DEFINE_PER_CPU(PFC_MUXCPU, pfcMuxCpu);
+static DEFINE_MUTEX(pfcMuxLock);
+static int        muxOn                = 0;
+static int        muxGroups            = 0;
+static uint64_t   muxPeriod            = 0;
+static DEFINE_PER_CPU(PFC_RINGCPU, pfcRingCpu);
+static DEFINE_MUTEX(pfcRingLock);
+static uint64_t*  ringBuf              = NULL;
+static uint64_t   ringPeriod           = 0;
+static struct cpumask ringCpus;
+static DEFINE_MUTEX(pfcRemoteLock);
+static struct cpumask remoteCpus;
 
 /**
  * The counters consist in the following MSRs on Core i7:
@@ -152,13 +315,54 @@ static const struct bin_attribute   PFC_ATTR_counts     = {
 static const struct bin_attribute   PFC_ATTR_msr        = {
 	.attr    = {.name="msr",    .mode=0660},
 	.size    = 0,
-	.read    = pfcMsrRd
+	.read    = pfcMsrRd,
+	.write   = pfcMsrWr
+};
+static const struct bin_attribute   PFC_ATTR_slots      = {
+	.attr    = {.name="slots",  .mode=0660},
+	.size    = PFC_ABI_NSLOTS*MAXPMC*sizeof(uint64_t),
+	.read    = pfcSlotsRd,
+	.write   = pfcSlotsWr
+};
+static const struct bin_attribute   PFC_ATTR_slot       = {
+	.attr    = {.name="slot",   .mode=0660},
+	.size    = sizeof(uint64_t),
+	.read    = pfcSlotRd,
+	.write   = pfcSlotWr
+};
+static const struct bin_attribute   PFC_ATTR_mux        = {
+	.attr    = {.name="mux",    .mode=0660},
+	.size    = PFC_ABI_MUX_SIZE*sizeof(uint64_t),
+	.read    = pfcMuxRd,
+	.write   = pfcMuxWr
+};
+static const struct bin_attribute   PFC_ATTR_remote     = {
+	.attr    = {.name="remote", .mode=0440},
+	.size    = 0,
+	.read    = pfcRemoteRd
+};
+static const struct bin_attribute   PFC_ATTR_offcore    = {
+	.attr    = {.name="offcore", .mode=0660},
+	.size    = 2*sizeof(uint64_t),
+	.read    = pfcOffcoreRd,
+	.write   = pfcOffcoreWr
+};
+static const struct bin_attribute   PFC_ATTR_rings      = {
+	.attr    = {.name="rings",  .mode=0440},
+	.size    = 0,
+	.mmap    = pfcRingsMmap
 };
 static const struct bin_attribute*  PFC_BIN_ATTR_GRP_LIST[] = {
 	&PFC_ATTR_config,
 	&PFC_ATTR_masks,
 	&PFC_ATTR_counts,
 	&PFC_ATTR_msr,
+	&PFC_ATTR_slots,
+	&PFC_ATTR_slot,
+	&PFC_ATTR_mux,
+	&PFC_ATTR_rings,
+	&PFC_ATTR_remote,
+	&PFC_ATTR_offcore,
 	NULL
 };
 
@@ -176,9 +380,17 @@ static struct kobj_attribute PFC_ATTR_cr4pce = {
 
 };
 
+static struct kobj_attribute PFC_ATTR_ring = {
+        .attr  = {.name="ring", .mode=0660},
+        .show  = pfcRingRd,
+        .store = pfcRingWr
+
+};
+
 static struct attribute*  PFC_STR_ATTR_GRP_LIST[] = {
 		&PFC_ATTR_verbose.attr,
 		&PFC_ATTR_cr4pce.attr,
+		&PFC_ATTR_ring.attr,
 		NULL
 };
 
@@ -279,14 +491,15 @@ static uint64_t pfcRDMSR(uint64_t addr){
 }
 
 /**
- * @brief WRMSR wrapper.
+ * @brief Blend a new MSR value with the reserved bits of the current one.
  * 
- * Writes to the given MSR. If it is a known MSR, mask out reserved bits into
- * a temporary, logic-OR the reserved bits into the temporary and write back
- * this temporary.
+ * If it is a known, writable MSR, mask out reserved bits of *newVal and
+ * logic-OR in those of the MSR's current value.
+ * 
+ * @return 0, or -1 if the MSR must not be written.
  */
 
-static void pfcWRMSR(uint64_t addr, uint64_t newVal){
+static int  pfcMsrBlend(uint64_t addr, uint64_t* newVal){
 	uint64_t mask;
 	
 	/**
@@ -306,7 +519,7 @@ static void pfcWRMSR(uint64_t addr, uint64_t newVal){
 	}else if(addr == MSR_IA32_PERF_GLOBAL_CTRL     ){
 		mask =                   ZV(pmcFf,  32) & ZV(pmcGp,   0);
 	}else if(addr == MSR_IA32_PERF_GLOBAL_STATUS   ){
-		return;/* RO MSR! */
+		return -1;/* RO MSR! */
 	}else if(addr == MSR_IA32_PERF_GLOBAL_OVF_CTRL ){
 		mask = ZV( 3,      61) & ZV(pmcFf,  32) & ZV(pmcGp,   0);
 	}else if(addr == MSR_IA32_FIXED_CTR_CTRL       ){
@@ -335,23 +548,63 @@ static void pfcWRMSR(uint64_t addr, uint64_t newVal){
 		mask =                                0xFFFFFFFFFFFFFFF0;
 	}else if(addr == MSR_IA32_PERF_CTL){
 		mask =                                0xFFFFFFFFFFFF0000;
+	}else if(addr == MSR_IA32_MISC_ENABLE){
+		mask =                                ~(1ULL<<38);/* Turbo Disable */
+	}else if(addr == MSR_IA32_DEBUGCTL){
+		mask =                                ~(1ULL<<14);/* FREEZE_WHILE_SMM */
+	}else if(addr == MSR_OFFCORE_RSP_0             ||
+	         addr == MSR_OFFCORE_RSP_1             ){
+		if(!offcoreRsvd){
+			return -1;/* Not known to exist on this model! */
+		}
+		mask =                                offcoreRsvd;
 	}else if(addr == MSR_PEBS_FRONTEND){
 		mask =                                0xFFFFFFFFFFC000E8;
 	}else{
-		return;/* Unknown MSR! Taking no chances! */
+		return -1;/* Unknown MSR! Taking no chances! */
 	}
 	
 	
 	/**
-	 * Blend new and old & Writeback
+	 * Blend new and old
 	 */
 	
-	newVal = (~mask&newVal) | (mask&pfcRDMSR(addr));
-	native_write_msr(addr,
-	                 (uint32_t)(newVal >>  0),
-	                 (uint32_t)(newVal >> 32));
+	*newVal = (~mask&*newVal) | (mask&pfcRDMSR(addr));
+	return 0;
+}
+
+/**
+ * @brief WRMSR wrapper.
+ * 
+ * Writes to the given MSR, if it is a known one, preserving its reserved
+ * bits.
+ */
+
+static void pfcWRMSR(uint64_t addr, uint64_t newVal){
+	if(pfcMsrBlend(addr, &newVal) == 0){
+		native_write_msr(addr,
+		                 (uint32_t)(newVal >>  0),
+		                 (uint32_t)(newVal >> 32));
+	}
+}
+
+/**
+ * @brief Faulting-safe WRMSR wrapper, for writes driven from userland.
+ * 
+ * Like pfcWRMSR(), but a #GP from a bit the CPU does not support is caught
+ * rather than oopsing the kernel.
+ * 
+ * @return 0, or -1 if the MSR is not writable or the write faulted.
+ */
+
+static int  pfcWRMSRSafe(uint64_t addr, uint64_t newVal){
+	if(pfcMsrBlend(addr, &newVal) != 0){
+		return -1;
+	}
+	return wrmsrl_safe(addr, newVal) == 0 ? 0 : -1;
 }
 
+
 /**
  * Clamp offset+len into a given counter range.
  * 
@@ -426,7 +679,7 @@ void     pfcGpCntWrEnb(int i, int      v){
 	en |= (uint64_t)!!v << ( 0+i);
 	pfcWRMSR(MSR_IA32_PERF_GLOBAL_CTRL, en);
 }
-void     pfcGpCntWrCfg(int i, uint64_t c){
+uint64_t pfcGpCntFilterCfg(int i, uint64_t c){
 	uint64_t evtNum, umask;
 	
 	/**
@@ -459,8 +712,22 @@ void     pfcGpCntWrCfg(int i, uint64_t c){
 		}
 	}
 	
+	/**
+	 * An offcore response event with no request or response selected counts
+	 * nothing useful, so the offcore MSR must be written first. On models
+	 * whose offcore MSRs we do not know, the event is never enabled.
+	 */
 	
-	pfcWRMSR(MSR_IA32_PERFEVTSEL0+i, c);
+	if((evtNum == 0xB7 || evtNum == 0xBB) &&
+	   (!offcoreRsvd || (pfcRDMSR(evtNum == 0xB7 ? MSR_OFFCORE_RSP_0 :
+	                                               MSR_OFFCORE_RSP_1) & 0xFFFF) == 0)){
+		c = 0;/* Disable. */
+	}
+	
+	return c;
+}
+void     pfcGpCntWrCfg(int i, uint64_t c){
+	pfcWRMSR(MSR_IA32_PERFEVTSEL0+i, pfcGpCntFilterCfg(i, c));
 }
 uint64_t pfcGpCntRdCfg(int i            ){
 	return pfcRDMSR(MSR_IA32_PERFEVTSEL0+i);
@@ -475,6 +742,271 @@ void     pfcGpCntWrVal(int i, uint64_t v){
 uint64_t pfcGpCntRdVal(int i            ){
 	return pfcRDMSR(MSR_IA32_PERFCTR0+i);
 }
+
+/* Slots */
+
+/**
+ * Switch the calling CPU's counters to a configuration slot.
+ * 
+ * Unlike pfcCfgWr(), which gates and reprograms one counter at a time, all
+ * counters are gated off by a single PERF_GLOBAL_CTRL write, reprogrammed
+ * and zeroed while stopped, then gated back on by a single write, so that
+ * they all start counting on the same cycle.
+ * 
+ * Must be called with interrupts disabled.
+ */
+
+void     pfcSlotSwitch(PFC_SLOTS* s, int slot){
+	const uint64_t* cfg = s->cfg[slot];
+	uint64_t        en  = 0, ff = 0, c;
+	int             i;
+	
+	pfcWRMSR(MSR_IA32_PERF_GLOBAL_CTRL, 0);
+	
+	for(i=0;i<pmcFf;i++){
+		c   = cfg[pmcStartFf+i] & 0x7;
+		ff |= BV(c, 4, 4*i);
+		en |= (uint64_t)!!(c & 0x3)        << (32+i);
+	}
+	pfcWRMSR(MSR_IA32_FIXED_CTR_CTRL, ff);
+	for(i=0;i<pmcGp;i++){
+		c   = pfcGpCntFilterCfg(i, cfg[pmcStartGp+i]);
+		pfcWRMSR(MSR_IA32_PERFEVTSEL0+i, c);
+		en |= (uint64_t)!!(c & 0x00400000) << ( 0+i);
+	}
+	
+	for(i=0;i<pmcFf;i++){
+		pfcFfCntWrVal(i, 0);
+	}
+	for(i=0;i<pmcGp;i++){
+		pfcGpCntWrVal(i, 0);
+	}
+	pfcWRMSR(MSR_IA32_PERF_GLOBAL_OVF_CTRL, ~0);
+	
+	pfcWRMSR(MSR_IA32_PERF_GLOBAL_CTRL, en);
+	s->cur = slot;
+}
+
+/* Multiplexing */
+
+/**
+ * Fold the counts of the calling CPU's current group into its totals and
+ * charge the group the time elapsed since it was switched in. The counters
+ * are left gated off; The caller switches a group back in, which zeroes them.
+ * 
+ * Must be called with interrupts disabled.
+ */
+
+static void pfcMuxHarvest(PFC_MUXCPU* m, uint64_t now){
+	uint64_t* cnt = m->tot.counts[m->group];
+	int       i;
+	
+	pfcWRMSR(MSR_IA32_PERF_GLOBAL_CTRL, 0);
+	for(i=0;i<pmcFf;i++){
+		cnt[pmcStartFf+i] += pfcFfCntRdVal(i) & pmcFfMask;
+	}
+	for(i=0;i<pmcGp;i++){
+		cnt[pmcStartGp+i] += pfcGpCntRdVal(i) & pmcGpMask;
+	}
+	m->tot.running[m->group] += now - m->since;
+	m->since                  = now;
+}
+
+/**
+ * Rotation timer, pinned to its CPU. Runs in hard interrupt context.
+ */
+
+static enum hrtimer_restart pfcMuxTick(struct hrtimer* t){
+	PFC_MUXCPU* m = container_of(t, PFC_MUXCPU, timer);
+	
+	pfcMuxHarvest(m, ktime_get_ns());
+	m->group = (m->group+1) % m->groups;
+	pfcSlotSwitch(this_cpu_ptr(&pfcSlots), m->group);
+	hrtimer_forward_now(t, ns_to_ktime(m->period));
+	return HRTIMER_RESTART;
+}
+
+/**
+ * Start, stop and snapshot the calling CPU's multiplexing. Called through
+ * on_each_cpu(), with interrupts disabled.
+ */
+
+static void pfcMuxStartCpu(void* unused){
+	PFC_MUXCPU* m = this_cpu_ptr(&pfcMuxCpu);
+	(void)unused;
+	
+	memset(&m->tot, 0, sizeof(m->tot));
+	m->groups = muxGroups;
+	m->period = muxPeriod;
+	m->group  = 0;
+	m->start  = m->since = ktime_get_ns();
+	pfcSlotSwitch(this_cpu_ptr(&pfcSlots), 0);
+	
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	hrtimer_setup(&m->timer, pfcMuxTick, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+#else
+	hrtimer_init(&m->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);/* Gone in 6.15 */
+	m->timer.function = pfcMuxTick;
+#endif
+	hrtimer_start(&m->timer, ns_to_ktime(m->period), HRTIMER_MODE_REL_PINNED);
+	m->on = 1;
+}
+static void pfcMuxStopCpu(void* unused){
+	PFC_MUXCPU* m = this_cpu_ptr(&pfcMuxCpu);
+	(void)unused;
+	
+	if(m->on){
+		pfcMuxHarvest(m, ktime_get_ns());
+		pfcSlotSwitch(this_cpu_ptr(&pfcSlots), m->group);
+		m->on = 0;
+	}
+}
+static void pfcMuxSnapCpu(void* unused){
+	PFC_MUXCPU* m = this_cpu_ptr(&pfcMuxCpu);
+	(void)unused;
+	
+	if(m->on){
+		pfcMuxHarvest(m, ktime_get_ns());
+		pfcSlotSwitch(this_cpu_ptr(&pfcSlots), m->group);
+	}
+	memcpy(&m->snap, &m->tot, sizeof(m->tot));
+}
+
+/**
+ * Stop multiplexing on all CPUs, keeping the totals.
+ * 
+ * The timers are cancelled from process context first, so that none fires
+ * after its CPU has folded in its last group.
+ * 
+ * Must be called with pfcMuxLock held.
+ */
+
+static void pfcMuxStop(void){
+	int cpu;
+	
+	if(!muxOn){
+		return;
+	}
+	for_each_online_cpu(cpu){
+		if(per_cpu(pfcMuxCpu, cpu).on){
+			hrtimer_cancel(&per_cpu(pfcMuxCpu, cpu).timer);
+		}
+	}
+	on_each_cpu(pfcMuxStopCpu, NULL, 1);
+	muxOn = 0;
+}
+
+/* Remote reads */
+
+/**
+ * Read the calling CPU's counters into its row of a remote read request.
+ * Called through IPI, with interrupts disabled.
+ */
+
+static void pfcRemoteSnapCpu(void* arg){
+	const PFC_REMOTE* r   = (const PFC_REMOTE*)arg;
+	uint64_t*         cnt = r->img + (smp_processor_id()-r->first)*PFC_ABI_REMOTE_NCNT;
+	int               i;
+	
+	for(i=0;i<pmcFf && pmcStartFf+i<PFC_ABI_REMOTE_NCNT;i++){
+		cnt[pmcStartFf+i] = pfcFfCntRdVal(i);
+	}
+	for(i=0;i<pmcGp && pmcStartGp+i<PFC_ABI_REMOTE_NCNT;i++){
+		cnt[pmcStartGp+i] = pfcGpCntRdVal(i);
+	}
+}
+
+/* Time series rings */
+
+static uint64_t* pfcRingOf(int cpu){
+	return ringBuf + (size_t)cpu*(PFC_ABI_RING_BYTES/sizeof(uint64_t));
+}
+
+/**
+ * Sampling timer, pinned to its CPU. Runs in hard interrupt context.
+ * 
+ * Counters are read as they are, not gated off or zeroed, so that sampling
+ * does not disturb any other user of them.
+ */
+
+static enum hrtimer_restart pfcRingTick(struct hrtimer* t){
+	PFC_RINGCPU* r   = container_of(t, PFC_RINGCPU, timer);
+	uint64_t*    hdr = pfcRingOf(smp_processor_id());
+	uint64_t     n   = hdr[PFC_ABI_RING_HEAD]+1;
+	uint64_t*    rec = hdr + PFC_ABI_RING_HDRW +
+	                   ((n-1) % PFC_ABI_RING_NREC)*PFC_ABI_RING_RECW;
+	uint64_t*    cnt = rec + PFC_ABI_RING_CNT;
+	int          i;
+	
+	WRITE_ONCE(rec[PFC_ABI_RING_SEQ], 0);
+	smp_wmb();
+	rec[PFC_ABI_RING_TSC] = rdtsc();
+	for(i=0;i<pmcFf && pmcStartFf+i<PFC_ABI_RING_NCNT;i++){
+		cnt[pmcStartFf+i] = pfcFfCntRdVal(i) & pmcFfMask;
+	}
+	for(i=0;i<pmcGp && pmcStartGp+i<PFC_ABI_RING_NCNT;i++){
+		cnt[pmcStartGp+i] = pfcGpCntRdVal(i) & pmcGpMask;
+	}
+	smp_wmb();
+	WRITE_ONCE(rec[PFC_ABI_RING_SEQ],  n);
+	smp_wmb();
+	WRITE_ONCE(hdr[PFC_ABI_RING_HEAD], n);
+	
+	hrtimer_forward_now(t, ns_to_ktime(r->period));
+	return HRTIMER_RESTART;
+}
+
+static void pfcRingStartCpu(void* unused){
+	PFC_RINGCPU* r = this_cpu_ptr(&pfcRingCpu);
+	(void)unused;
+	
+	r->period = ringPeriod;
+	WRITE_ONCE(pfcRingOf(smp_processor_id())[PFC_ABI_RING_PERIOD], ringPeriod);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	hrtimer_setup(&r->timer, pfcRingTick, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);
+#else
+	hrtimer_init(&r->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED);/* Gone in 6.15 */
+	r->timer.function = pfcRingTick;
+#endif
+	hrtimer_start(&r->timer, ns_to_ktime(r->period), HRTIMER_MODE_REL_PINNED);
+	r->on = 1;
+}
+
+/**
+ * Allocate the rings of all possible CPUs, once. They are never freed before
+ * module exit, since userspace may have them mapped.
+ * 
+ * Must be called with pfcRingLock held.
+ */
+
+static int  pfcRingAlloc(void){
+	if(!ringBuf){
+		ringBuf = vmalloc_user((size_t)nr_cpu_ids*PFC_ABI_RING_BYTES);
+	}
+	return ringBuf ? 0 : -ENOMEM;
+}
+
+/**
+ * Stop sampling on all CPUs. Records already written remain.
+ * 
+ * Must be called with pfcRingLock held.
+ */
+
+static void pfcRingStop(void){
+	PFC_RINGCPU* r;
+	int          cpu;
+	
+	for_each_possible_cpu(cpu){
+		r = &per_cpu(pfcRingCpu, cpu);
+		if(r->on){
+			hrtimer_cancel(&r->timer);
+			WRITE_ONCE(pfcRingOf(cpu)[PFC_ABI_RING_PERIOD], 0);
+			r->on = 0;
+		}
+	}
+	ringPeriod = 0;
+	cpumask_clear(&ringCpus);
+}
 /*************** END COUNTER MANIPULATION ***************/
 
 
@@ -555,6 +1087,7 @@ static ssize_t pfcCfgWr(struct file*          f,
 	}
 	
 	/* Write relevant MSRs */
+	this_cpu_write(pfcSlots.cur, PFC_ABI_NOSLOT);
 	j=0;
 	if(pfcClampRange(off>>3, len>>3, pmcStartFf, pmcEndFf, &pmcStart, &pmcEnd)){
 		pmcStart -= pmcStartFf;
@@ -762,6 +1295,7 @@ static ssize_t pfcMsrRd (struct file*          f,
 		case MSR_IA32_PERF_STATUS:
 		case MSR_IA32_PERF_CTL:
 		case MSR_IA32_MISC_ENABLE:
+		case MSR_IA32_DEBUGCTL:
 		case MSR_PLATFORM_INFO:
 		case MSR_IA32_TEMPERATURE_TARGET:
 			*(uint64_t*)buf = pfcRDMSR(off);
@@ -801,6 +1335,383 @@ static ssize_t pfcMsrRd (struct file*          f,
 	}
 }
 
+/**
+ * Write MSRs of the calling CPU from userland.
+ * 
+ * Only the benchmark-quiescing controls are accepted, and pfcWRMSRSafe()
+ * only lets through their documented bits: The P-state request of PERF_CTL,
+ * the 4-bit EPB, Turbo Disable (bit 38) of MISC_ENABLE and FREEZE_WHILE_SMM
+ * (bit 14) of DEBUGCTL. Each is refused unless enumerated (EPB and turbo by
+ * CPUID leaf 6, FREEZE_WHILE_SMM by IA32_PERF_CAPABILITIES[12]), and a write
+ * that faults anyway fails instead of oopsing. Unlike the rest of this
+ * module's files, msr is only writable by root.
+ * 
+ * @return MSR bytes written
+ */
+
+static ssize_t pfcMsrWr (struct file*          f,
+                         struct kobject*       kobj,
+                         struct bin_attribute* binattr,
+                         char*                 buf,
+                         loff_t                off,
+                         size_t                len){
+	if(len != 8){
+		return -1;
+	}
+	
+	switch(off){
+		case MSR_IA32_ENERGY_PERF_BIAS:
+			if(!(leaf6.c & (1ULL<<3))){
+				return -1;
+			}
+		break;
+		case MSR_IA32_MISC_ENABLE:
+			if(!(leaf6.a & (1ULL<<1))){
+				return -1;/* No turbo to disable. */
+			}
+		break;
+		case MSR_IA32_DEBUGCTL:
+			if(!freezeWhileSmm){
+				return -1;
+			}
+		break;
+		case MSR_IA32_PERF_CTL:
+		break;
+		default:
+		return -1;
+	}
+	return pfcWRMSRSafe(off, *(uint64_t*)buf) == 0 ? len : -1;
+}
+
+/**
+ * Read preloaded configuration slots of the calling CPU.
+ * 
+ * @return Bytes of slot data read
+ */
+
+static ssize_t pfcSlotsRd(struct file*          f,
+                          struct kobject*       kobj,
+                          struct bin_attribute* binattr,
+                          char*                 buf,
+                          loff_t                off,
+                          size_t                len){
+	PFC_SLOTS* s;
+	
+	/* Check access is reasonable. */
+	if(!pfcIsAligned(off, len, 0x7) || off<0 ||
+	   off+len > sizeof(s->cfg)){
+		return -1;
+	}
+	
+	s = &get_cpu_var(pfcSlots);
+	memcpy(buf, (char*)s->cfg + off, len);
+	put_cpu_var(pfcSlots);
+	return len;
+}
+
+/**
+ * Preload configuration slots, on all CPUs.
+ * 
+ * Nothing is programmed into the counters until a slot is switched to. A slot
+ * should not be reloaded while a CPU is switching to it.
+ * 
+ * @return Bytes of slot data written
+ */
+
+static ssize_t pfcSlotsWr(struct file*          f,
+                          struct kobject*       kobj,
+                          struct bin_attribute* binattr,
+                          char*                 buf,
+                          loff_t                off,
+                          size_t                len){
+	int cpu;
+	
+	/* Check access is reasonable. */
+	if(!pfcIsAligned(off, len, 0x7) || off<0 ||
+	   off+len > sizeof(((PFC_SLOTS*)0)->cfg)){
+		return -1;
+	}
+	
+	for_each_possible_cpu(cpu){
+		memcpy((char*)per_cpu(pfcSlots, cpu).cfg + off, buf, len);
+	}
+	return len;
+}
+
+/**
+ * Read the current slot of the calling CPU.
+ * 
+ * @return Bytes read
+ */
+
+static ssize_t pfcSlotRd (struct file*          f,
+                          struct kobject*       kobj,
+                          struct bin_attribute* binattr,
+                          char*                 buf,
+                          loff_t                off,
+                          size_t                len){
+	if(off != 0 || len != sizeof(uint64_t)){
+		return -1;
+	}
+	
+	*(uint64_t*)buf = this_cpu_read(pfcSlots.cur);
+	return len;
+}
+
+/**
+ * Switch the calling CPU to the given slot.
+ * 
+ * @return Bytes written
+ */
+
+static ssize_t pfcSlotWr (struct file*          f,
+                          struct kobject*       kobj,
+                          struct bin_attribute* binattr,
+                          char*                 buf,
+                          loff_t                off,
+                          size_t                len){
+	uint64_t      slot;
+	unsigned long flags;
+	
+	if(off != 0 || len != sizeof(uint64_t)){
+		return -1;
+	}
+	slot = *(uint64_t*)buf;
+	if(slot >= PFC_ABI_NSLOTS){
+		return -1;
+	}
+	
+	local_irq_save(flags);
+	pfcSlotSwitch(this_cpu_ptr(&pfcSlots), slot);
+	local_irq_restore(flags);
+	return len;
+}
+
+/**
+ * Read multiplexing totals, summed over all online CPUs.
+ * 
+ * Every CPU first folds in the counts of its current group, so that the totals
+ * are current to within an IPI.
+ * 
+ * @return Bytes read
+ */
+
+static ssize_t pfcMuxRd  (struct file*          f,
+                          struct kobject*       kobj,
+                          struct bin_attribute* binattr,
+                          char*                 buf,
+                          loff_t                off,
+                          size_t                len){
+	uint64_t*         img, *row;
+	const PFC_MUXTOT* t;
+	int               cpu, g, i;
+	
+	/* Check access is reasonable. */
+	if(!pfcIsAligned(off, len, 0x7) || off<0 ||
+	   off+len > PFC_ABI_MUX_SIZE*sizeof(uint64_t)){
+		return -1;
+	}
+	img = kzalloc(PFC_ABI_MUX_SIZE*sizeof(uint64_t), GFP_KERNEL);
+	if(!img){
+		return -1;
+	}
+	
+	mutex_lock(&pfcMuxLock);
+	on_each_cpu(pfcMuxSnapCpu, NULL, 1);
+	img[0] = muxGroups;
+	img[1] = muxPeriod;
+	for_each_online_cpu(cpu){
+		t = &per_cpu(pfcMuxCpu, cpu).snap;
+		for(g=0;g<PFC_ABI_NSLOTS;g++){
+			row     = img + PFC_ABI_MUX_HDR + g*PFC_ABI_MUX_STRIDE;
+			img[2] += t->running[g];
+			row[0] += t->running[g];
+			for(i=0;i<MAXPMC;i++){
+				row[1+i] += t->counts[g][i];
+			}
+		}
+	}
+	mutex_unlock(&pfcMuxLock);
+	
+	memcpy(buf, (char*)img + off, len);
+	kfree(img);
+	return len;
+}
+
+/**
+ * Start or stop multiplexing.
+ * 
+ * Starting zeroes the totals and switches every online CPU to slot 0. While
+ * multiplexing, the counters belong to the timers: Writes to config or slot
+ * are overridden at the next rotation.
+ * 
+ * @return Bytes written
+ */
+
+static ssize_t pfcMuxWr  (struct file*          f,
+                          struct kobject*       kobj,
+                          struct bin_attribute* binattr,
+                          char*                 buf,
+                          loff_t                off,
+                          size_t                len){
+	uint64_t* buf64 = (uint64_t*)buf;
+	
+	if(off != 0 || len != 2*sizeof(uint64_t)){
+		return -1;
+	}
+	if(buf64[0] > PFC_ABI_NSLOTS ||
+	   (buf64[0] && buf64[1] < PFC_ABI_MUX_MINPERIOD)){
+		return -1;
+	}
+	
+	mutex_lock(&pfcMuxLock);
+	pfcMuxStop();
+	if(buf64[0]){
+		muxGroups = buf64[0];
+		muxPeriod = buf64[1];
+		muxOn     = 1;
+		on_each_cpu(pfcMuxStartCpu, NULL, 1);
+	}
+	mutex_unlock(&pfcMuxLock);
+	return len;
+}
+
+/**
+ * Read the counters of other CPUs.
+ * 
+ * The CPUs whose rows the read overlaps are all sent the IPI at once, then
+ * waited for; Offline CPUs read as zeroes.
+ * 
+ * @return Bytes of count data read
+ */
+
+static ssize_t pfcRemoteRd(struct file*          f,
+                           struct kobject*       kobj,
+                           struct bin_attribute* binattr,
+                           char*                 buf,
+                           loff_t                off,
+                           size_t                len){
+	PFC_REMOTE r;
+	int        cpu, last;
+	
+	/* Check access is reasonable. */
+	if(!pfcIsAligned(off, len, 0x7) || off<0 || len==0 ||
+	   off+len > (loff_t)nr_cpu_ids*PFC_ABI_REMOTE_STRIDE){
+		return -1;
+	}
+	r.first = off         / PFC_ABI_REMOTE_STRIDE;
+	last    = (off+len-1) / PFC_ABI_REMOTE_STRIDE;
+	r.img   = kzalloc((last-r.first+1)*PFC_ABI_REMOTE_STRIDE, GFP_KERNEL);
+	if(!r.img){
+		return -1;
+	}
+	
+	if(r.first == last){
+		if(cpu_online(r.first)){
+			smp_call_function_single(r.first, pfcRemoteSnapCpu, &r, 1);
+		}
+	}else{
+		mutex_lock(&pfcRemoteLock);
+		cpumask_clear(&remoteCpus);
+		for(cpu=r.first;cpu<=last;cpu++){
+			if(cpu_online(cpu)){
+				cpumask_set_cpu(cpu, &remoteCpus);
+			}
+		}
+		on_each_cpu_mask(&remoteCpus, pfcRemoteSnapCpu, &r, 1);
+		mutex_unlock(&pfcRemoteLock);
+	}
+	
+	memcpy(buf, (char*)r.img + (off - r.first*PFC_ABI_REMOTE_STRIDE), len);
+	kfree(r.img);
+	return len;
+}
+
+/**
+ * Read the offcore response MSRs of the calling CPU.
+ * 
+ * @return Bytes read
+ */
+
+static ssize_t pfcOffcoreRd(struct file*          f,
+                            struct kobject*       kobj,
+                            struct bin_attribute* binattr,
+                            char*                 buf,
+                            loff_t                off,
+                            size_t                len){
+	uint64_t* rsp = (uint64_t*)buf;
+	int       i;
+	
+	/* Check access is reasonable. */
+	if(!offcoreRsvd || !pfcIsAligned(off, len, 0x7) || off<0 || off+len > 2*sizeof(uint64_t)){
+		return -1;
+	}
+	
+	for(i=0;i<len/8;i++){
+		rsp[i] = pfcRDMSR(MSR_OFFCORE_RSP_0+off/8+i);
+	}
+	return len;
+}
+
+/**
+ * Write the offcore response MSRs of the calling CPU.
+ * 
+ * They are shared by all counters, so this is separate from config; Counters
+ * already configured for an offcore event keep counting with the new value.
+ * 
+ * @return Bytes written
+ */
+
+static ssize_t pfcOffcoreWr(struct file*          f,
+                            struct kobject*       kobj,
+                            struct bin_attribute* binattr,
+                            char*                 buf,
+                            loff_t                off,
+                            size_t                len){
+	const uint64_t* rsp = (const uint64_t*)buf;
+	int             i;
+	
+	/* Check access is reasonable. */
+	if(!offcoreRsvd || !pfcIsAligned(off, len, 0x7) || off<0 || off+len > 2*sizeof(uint64_t)){
+		return -1;
+	}
+	
+	for(i=0;i<len/8;i++){
+		pfcWRMSR(MSR_OFFCORE_RSP_0+off/8+i, rsp[i]);
+	}
+	return len;
+}
+
+/**
+ * Map CPU rings read-only.
+ * 
+ * @return 0 on success, negative errno otherwise
+ */
+
+static int     pfcRingsMmap(struct file*           f,
+                            struct kobject*        kobj,
+                            struct bin_attribute*  binattr,
+                            struct vm_area_struct* vma){
+	int ret;
+	
+	if(vma->vm_flags & VM_WRITE){
+		return -EPERM;
+	}
+	
+	mutex_lock(&pfcRingLock);
+	ret = pfcRingAlloc();
+	if(ret == 0){
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+		vm_flags_clear(vma, VM_MAYWRITE);/* vm_flags is read-only since 6.3 */
+#else
+		vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+		ret = remap_vmalloc_range(vma, ringBuf, vma->vm_pgoff);
+	}
+	mutex_unlock(&pfcRingLock);
+	return ret;
+}
+
 static ssize_t pfcVerboseRd(struct kobject* kobj,
                             struct kobj_attribute* attr,
                             char* buf) {
@@ -815,6 +1726,53 @@ static ssize_t pfcCR4PceRd(struct kobject* kobj,
 	return 1;
 }
 
+static ssize_t pfcRingRd  (struct kobject* kobj,
+                           struct kobj_attribute* attr,
+                           char* buf) {
+	ssize_t n;
+	
+	mutex_lock(&pfcRingLock);
+	n = scnprintf(buf, PAGE_SIZE, "%llu %*pbl\n",
+	              (unsigned long long)ringPeriod, cpumask_pr_args(&ringCpus));
+	mutex_unlock(&pfcRingLock);
+	return n;
+}
+
+/**
+ * Start sampling on "<period in ns> <cpulist>", replacing any previous
+ * selection, or stop on "0". Offline CPUs of the list are skipped.
+ */
+
+static ssize_t pfcRingWr  (struct kobject* kobj,
+                           struct kobj_attribute* attr,
+                           const char* buf,
+                           size_t count) {
+	static struct cpumask cpus;
+	unsigned long long    period;
+	int                   n = 0;
+	
+	if(sscanf(buf, "%llu %n", &period, &n) < 1){
+		return -1;
+	}
+	
+	mutex_lock(&pfcRingLock);
+	if(period && (period < PFC_ABI_RING_MINPERIOD ||
+	              cpulist_parse(buf+n, &cpus) != 0 ||
+	              pfcRingAlloc()          != 0)){
+		mutex_unlock(&pfcRingLock);
+		printk(KERN_NOTICE "pfc: bad value written to ring, expected '<period ns> <cpulist>' or '0' but got '%s'\n", buf);
+		return -1;
+	}
+	pfcRingStop();
+	if(period){
+		ringPeriod = period;
+		cpumask_and(&ringCpus, &cpus, cpu_online_mask);
+		on_each_cpu_mask(&ringCpus, pfcRingStartCpu, NULL, 1);
+	}
+	mutex_unlock(&pfcRingLock);
+	return count;
+}
+
 static ssize_t pfcVerboseWr(struct kobject* kobj,
                             struct kobj_attribute* attr,
                             const char* buf,
@@ -863,6 +1821,27 @@ static int  pfcInitCPUID(void){
 	dispFamily      = (        family != 0x0F        ) ? family : (family+exfamily);
 	dispModel       = (family == 0x06 || family==0x0F) ? (exmodel<<4|model) : model;
 	
+	/**
+	 * MSR_OFFCORE_RSP_x: Requests in bits 15:0, responses in 37:16. Request
+	 * bits 12-14 are reserved on Haswell and Broadwell, and 3, 6, 9 and
+	 * 11-14 from Skylake on; Writing any of them #GPs.
+	 */
+	
+	if(dispFamily == 0x06){
+		switch(dispModel){
+			case 0x3C: case 0x3F: case 0x45: case 0x46:/* Haswell */
+			case 0x3D: case 0x47: case 0x4F: case 0x56:/* Broadwell */
+				offcoreRsvd = 0xFFFFFFC000000000ULL | 0x7000;
+			break;
+			case 0x4E: case 0x5E: case 0x55:           /* Skylake */
+			case 0x8E: case 0x9E: case 0xA5: case 0xA6:/* Kaby/Coffee/Comet Lake */
+				offcoreRsvd = 0xFFFFFFC000000000ULL | 0x7A48;
+			break;
+			default:
+			break;
+		}
+	}
+	
 	maxLeaf         = leaf0.a;
 	maxExtendedLeaf = leaf80000000.a;
 	memcpy(&procBrandString[ 0], (const char*)&leaf80000002, 16);
@@ -933,6 +1912,7 @@ static int  pfcInitCPUID(void){
 	}
 	
 	fullWidthWrites = (pfcRDMSR(MSR_IA32_PERF_CAPABILITIES) >> 13) & 1;
+	freezeWhileSmm  = (pfcRDMSR(MSR_IA32_PERF_CAPABILITIES) >> 12) & 1;
 	
 	pmcGp         = (leafA.a >>  8) & 0xFF;
 	pmcGpBitwidth = (leafA.a >> 16) & 0xFF;
@@ -1002,7 +1982,7 @@ static void pfcInitCounters(void* unused){
  */
 
 static int __init pfcInit(void){
-	int ret;
+	int ret, cpu;
 	
 	
 	if(pfcInitCPUID() != 0){
@@ -1018,6 +1998,9 @@ static int __init pfcInit(void){
 	}
 	
 	on_each_cpu(pfcInitCounters, NULL, 1);
+	for_each_possible_cpu(cpu){
+		per_cpu(pfcSlots, cpu).cur = PFC_ABI_NOSLOT;
+	}
 	
 	/**
 	 * The chmods that follow are necessary because sysfs_create_group()
@@ -1034,11 +2017,25 @@ static int __init pfcInit(void){
 	ret |= sysfs_chmod_file  ((struct kobject*)  &THIS_MODULE->mkobj,
 	                          (struct attribute*)&PFC_ATTR_counts,  0666);
 	ret |= sysfs_chmod_file  ((struct kobject*)  &THIS_MODULE->mkobj,
-	                          (struct attribute*)&PFC_ATTR_msr,     0444);
+	                          (struct attribute*)&PFC_ATTR_msr,     0644);
 	ret |= sysfs_chmod_file  ((struct kobject*)  &THIS_MODULE->mkobj,
 		                      (struct attribute*)&PFC_ATTR_verbose, 0666);
 	ret |= sysfs_chmod_file  ((struct kobject*)  &THIS_MODULE->mkobj,
 	                          (struct attribute*)&PFC_ATTR_cr4pce,  0444);
+	ret |= sysfs_chmod_file  ((struct kobject*)  &THIS_MODULE->mkobj,
+	                          (struct attribute*)&PFC_ATTR_slots,   0666);
+	ret |= sysfs_chmod_file  ((struct kobject*)  &THIS_MODULE->mkobj,
+	                          (struct attribute*)&PFC_ATTR_slot,    0666);
+	ret |= sysfs_chmod_file  ((struct kobject*)  &THIS_MODULE->mkobj,
+	                          (struct attribute*)&PFC_ATTR_mux,     0666);
+	ret |= sysfs_chmod_file  ((struct kobject*)  &THIS_MODULE->mkobj,
+	                          (struct attribute*)&PFC_ATTR_rings,   0444);
+	ret |= sysfs_chmod_file  ((struct kobject*)  &THIS_MODULE->mkobj,
+	                          (struct attribute*)&PFC_ATTR_remote,  0444);
+	ret |= sysfs_chmod_file  ((struct kobject*)  &THIS_MODULE->mkobj,
+	                          (struct attribute*)&PFC_ATTR_offcore, 0666);
+	ret |= sysfs_chmod_file  ((struct kobject*)  &THIS_MODULE->mkobj,
+	                          (struct attribute*)&PFC_ATTR_ring,    0666);
 	if(ret != 0){
 		printk(KERN_INFO "pfc: ERROR: Failed to create sysfs attributes.\n");
 		goto lateFail;
@@ -1067,9 +2064,17 @@ static int __init pfcInit(void){
 static void        pfcExit(void){
 	printk(KERN_INFO "pfc: Module exiting...\n");
 	
+	mutex_lock(&pfcMuxLock);
+	pfcMuxStop();
+	mutex_unlock(&pfcMuxLock);
+	mutex_lock(&pfcRingLock);
+	pfcRingStop();
+	mutex_unlock(&pfcRingLock);
 	on_each_cpu(pfcInitCounters, NULL, 1);
 	sysfs_remove_group((struct kobject*)&THIS_MODULE->mkobj,
 	                   &PFC_ATTR_GRP);
+	vfree(ringBuf);
+	ringBuf = NULL;
 	
 	printk(KERN_INFO "pfc: Module exited.\n");
 }
@@ -2,30 +2,34 @@
 #define _GNU_SOURCE
 
 #include "libpfc.h"
+#include "libpfcevt.h"
+#include <cpuid.h>
 #include <ctype.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sched.h>
 
 
+/* Defines */
+#define MAXCPU                         4096
+
+
 /* Data Structures */
-struct UMASK;
-typedef struct UMASK UMASK;
-struct EVENT;
-typedef struct EVENT EVENT;
-
-struct UMASK{
-	uint64_t      umaskVal;
-	const char*   name;
-};
-struct EVENT{
-	uint64_t      evtNum;
-	const UMASK*  umasks;
-	const char*   name;
+typedef PFC_UMASK UMASK;
+typedef PFC_EVENT EVENT;
+
+struct OFFCORE;
+typedef struct OFFCORE OFFCORE;
+
+struct OFFCORE{
+	const char* name;
+	uint64_t    rsp;
+	uint64_t    rspHsw;   /* Haswell and Broadwell */
 };
 
 
@@ -35,355 +39,39 @@ static int      mskFd    = -1;
 static int      cntFd    = -1;
 static int      msrFd    = -1;
 static int      cr4Fd    = -1;
+static int      slotsFd  = -1;
+static int      slotFd   = -1;
+static int      muxFd    = -1;
+static int      rmtFd    = -1;
+static int      offFd    = -1;
 static uint64_t masks[7] = {0,0,0,0,0,0,0};
+static uint64_t cfgSigs[MAXCPU];
+static PFC_CFG  cfgImgs[MAXCPU][7];
+static uint8_t  cfgKnown[MAXCPU];
+static PFC_CFG  slotImgs[PFC_ABI_NSLOTS][7];
+static uint8_t  slotKnown[PFC_ABI_NSLOTS];
 
-static const struct UMASK UMASK_LIST[]         = {
-    {0x02, "store_forward"},        /*   0 */ /* 0x03 */
-    {0x08, "no_sr"},
-    {0x00, NULL},
-    {0x01, "loads"},                /*   3 */ /* 0x05 */
-    {0x02, "stores"},
-    {0x00, NULL},
-    {0x01, "address_alias"},        /*   6 */ /* 0x07 */
-    {0x00, NULL},
-    {0x01, "miss_causes_a_walk"},   /*   8 */ /* 0x08 */
-    {0x02, "walk_completed_4k"},
-    {0x04, "walk_completed_2m_4m"},
-    {0x0e, "walk_completed"},
-    {0x10, "walk_duration"},
-    {0x20, "stlb_hit_4k"},
-    {0x40, "stlb_hit_2m"},
-    {0x60, "stlb_hit"},
-    {0x80, "pde_cache_miss"},
-    {0x00, NULL},
-    {0x03, "recovery_cycles"},      /*  18 */ /* 0x0D */
-    {0x00, NULL},
-    {0x01, "any"},                  /*  20 */ /* 0x0E */
-    {0x10, "flags_merge"},
-    {0x20, "slow_lea"},
-    {0x40, "single_mul"},
-    {0x00, NULL},
-    {0x21, "demand_data_rd_miss"},  /*  25 */ /* 0x24 */
-    {0x41, "demand_data_rd_hit"},
-    {0xE1, "all_demand_data_rd"},
-    {0x42, "rfo_hit"},
-    {0x22, "rfo_miss"},
-    {0xE2, "all_rfo"},
-    {0x44, "code_rd_hit"},
-    {0x24, "code_rd_miss"},
-    {0x27, "all_demand_miss"},
-    {0xE7, "all_demand_references"},
-    {0xE4, "all_code_rd"},
-    {0x50, "l2_pf_hit"},
-    {0x30, "l2_pf_miss"},
-    {0xF8, "all_pf"},
-    {0x3F, "miss"},
-    {0xFF, "references"},
-    {0x00, NULL},
-    {0x50, "wb_hit"},               /*  42 */ /* 0x27 */
-    {0x00, NULL},
-    {0x4F, "reference"},            /*  44 */ /* 0x2E */
-    {0x41, "miss"},
-    {0x00, NULL},
-    {0x00, "core_clk"},             /*  47 */ /* 0x3C */
-    {0x01, "ref_xclk"},
-    {0x00, NULL},
-    {0x01, "pending"},              /*  50 */ /* 0x48 */
-    {0x00, NULL},
-    {0x01, "miss_causes_a_walk"},   /*  52 */ /* 0x49 */
-    {0x02, "walk_completed_4k"},
-    {0x04, "walk_completed_2m_4m"},
-    {0x0E, "walk_completed"},
-    {0x10, "walk_duration"},
-    {0x20, "stlb_hit_4k"},
-    {0x40, "stlb_hit_2m"},
-    {0x60, "stlb_hit"},
-    {0x80, "pde_cache_miss"},
-    {0x00, NULL},
-    {0x01, "sw_pf"},                /*  62 */ /* 0x4C */
-    {0x02, "hw_pf"},
-    {0x00, NULL},
-    {0x01, "replacement"},          /*  65 */ /* 0x51 */
-    {0x00, NULL},
-    {0x01, "abort_conflict"},       /*  67 */ /* 0x54 */
-    {0x02, "abort_capacity_write"},
-    {0x04, "abort_hle_store_to_elided_lock"},
-    {0x08, "abort_hle_elision_buffer_not_empty"},
-    {0x10, "abort_hle_elision_buffer_mismatch"},
-    {0x20, "abort_hle_elision_buffer_unsupported_alignment"},
-    {0x40, "hle_elision_buffer_full"},
-    {0x00, NULL},
-    {0x04, "int_not_eliminated"},   /*  75 */ /* 0x58 */
-    {0x08, "simd_not_eliminated"},
-    {0x01, "int_not_eliminated"},
-    {0x02, "simd_eliminated"},
-    {0x00, NULL},
-    {0x01, "ring0"},                /*  80 */ /* 0x5C */
-    {0x02, "ring123"},
-    {0x00, NULL},
-    {0x01, "misc1"},                /*  83 */ /* 0x5D */
-    {0x02, "misc2"},
-    {0x04, "misc3"},
-    {0x08, "misc4"},
-    {0x10, "misc5"},
-    {0x00, NULL},
-    {0x01, "empty_cycles"},         /*  89 */ /* 0x5E */
-    {0x00, NULL},
-    {0x01, "demand_data_rd"},       /*  91 */ /* 0x60 */
-    {0x02, "demand_code_rd"},
-    {0x04, "demand_rfo"},
-    {0x08, "all_data_rd"},
-    {0x00, NULL},
-    {0x01, "split_lock_uc_lock_duration"}, /*  96 */ /* 0x63 */
-    {0x02, "cache_lock_duration"},
-    {0x00, NULL},
-    {0x02, "empty"},                /*  99 */ /* 0x79 */
-    {0x04, "mite_uops"},
-    {0x08, "dsb_uops"},
-    {0x10, "ms_dsb_uops"},
-    {0x20, "ms_mite_uops"},
-    {0x30, "ms_uops"},
-    {0x18, "all_dsb_cycles_any_uops"},
-    {0x18, "all_dsb_cycles_4_uops"},
-    {0x24, "all_mite_cycles_any_uops"},
-    {0x24, "all_mite_cycles_4_uops"},
-    {0x3C, "mite_all_uops"},
-    {0x00, NULL},
-    {0x02, "misses"},               /* 111 */ /* 0x80 */
-    {0x00, NULL},
-    {0x01, "miss_causes_a_walk"},   /* 113 */ /* 0x85 */
-    {0x02, "walk_completed_4k"},
-    {0x04, "walk_completed_2m_4m"},
-    {0x0E, "walk_completed"},
-    {0x10, "walk_duration"},
-    {0x20, "stlb_hit_4k"},
-    {0x40, "stlb_hit_2m"},
-    {0x60, "stlb_hit"},
-    {0x00, NULL},
-    {0x01, "lcp"},                  /* 122 */ /* 0x87 */
-    {0x04, "iq_full"},
-    {0x00, NULL},
-    {0x01, "cond"},                 /* 125 */ /* 0x88 */
-    {0x02, "direct_jmp"},
-    {0x04, "indirect_jmp_non_call_ret"},
-    {0x08, "return_near"},
-    {0x10, "direct_near_call"},
-    {0x20, "indirect_near_call"},
-    {0x40, "nontaken"},
-    {0x80, "taken"},
-    {0xFF, "all_branches"},
-    {0x00, NULL},
-    {0x01, "cond"},                 /* 135 */ /* 0x89 */
-    {0x04, "indirect_jmp_non_call_ret"},
-    {0x08, "return_near"},
-    {0x10, "direct_near_call"},
-    {0x20, "indirect_near_call"},
-    {0x40, "nontaken"},
-    {0x80, "taken"},
-    {0xFF, "all_branches"},
-    {0x00, NULL},
-    {0x01, "core"},                 /* 144 */ /* 0x9C */
-    {0x00, NULL},
-    {0x01, "port_0"},               /* 146 */ /* 0xA1 */
-    {0x02, "port_1"},
-    {0x04, "port_2"},
-    {0x08, "port_3"},
-    {0x10, "port_4"},
-    {0x20, "port_5"},
-    {0x40, "port_6"},
-    {0x80, "port_7"},
-    {0x00, NULL},
-    {0x01, "any"},                  /* 155 */ /* 0xA2 */
-    {0x04, "rs"},
-    {0x08, "sb"},
-    {0x10, "rob"},
-    {0x00, NULL},
-    {0x01, "cycles_l2_pending"},    /* 160 */ /* 0xA3 */
-    {0x02, "cycles_ldm_pending"},
-    {0x05, "stalls_l2_pending"},
-    {0x08, "cycles_l1d_pending"},
-    {0x0C, "stalls_l1d_pending"},
-    {0x00, NULL},
-    {0x01, "uops"},                 /* 166 */ /* 0xA8 */
-    {0x00, NULL},
-    {0x01, "itlb_flush"},           /* 168 */ /* 0xAE */
-    {0x00, NULL},
-    {0x01, "demand_data_rd"},       /* 170 */ /* 0xB0 */
-    {0x02, "demand_core_rd"},
-    {0x04, "demand_rfo"},
-    {0x08, "all_data_rd"},
-    {0x00, NULL},
-    {0x02, "core"},                 /* 175 */ /* 0xB1 */
-    {0x00, NULL},
-    {0x11, "dtlb_l1"},              /* 177 */ /* 0xBC */
-    {0x21, "itlb_l1"},
-    {0x12, "dtlb_l2"},
-    {0x22, "itlb_l2"},
-    {0x14, "dtlb_l3"},
-    {0x24, "itlb_l3"},
-    {0x18, "dtlb_memory"},
-    {0x28, "itlb_memory"},
-    {0x00, NULL},
-    {0x01, "dtlb_thread"},          /* 186 */ /* 0xBD */
-    {0x20, "stlb_any"},
-    {0x00, NULL},
-    {0x00, "any_p"},                /* 189 */ /* 0xC0 */
-    {0x01, "prec_dist"},
-    {0x00, NULL},
-    {0x08, "avx_to_sse"},           /* 192 */ /* 0xC1 */
-    {0x10, "sse_to_avx"},
-    {0x40, "any_wb_assist"},
-    {0x00, NULL},
-    {0x01, "all"},                  /* 196 */ /* 0xC2 */
-    {0x02, "retire_slots"},
-    {0x00, NULL},
-    {0x02, "memory_ordering"},      /* 199 */ /* 0xC3 */
-    {0x04, "smc"},
-    {0x20, "maskmov"},
-    {0x00, NULL},
-    {0x00, "all_branches"},         /* 203 */ /* 0xC4 */
-    {0x01, "conditional"},
-    {0x02, "near_call"},
-    {0x04, "all_branches_pebs"},
-    {0x08, "near_return"},
-    {0x10, "not_taken"},
-    {0x20, "near_taken"},
-    {0x40, "far_branch"},
-    {0x00, NULL},
-    {0x00, "all_branches"},         /* 212 */ /* 0xC5 */
-    {0x01, "conditional"},
-    {0x04, "all_branches_pebs"},
-    {0x20, "near_taken"},
-    {0x00, NULL},
-    {0x01, "start"},                /* 217 */ /* 0xC8 */
-    {0x02, "commit"},
-    {0x04, "aborted"},
-    {0x08, "aborted_mem"},
-    {0x10, "aborted_timer"},
-    {0x20, "aborted_unfriendly"},
-    {0x40, "aborted_memtype"},
-    {0x80, "aborted_events"},
-    {0x00, NULL},
-    {0x01, "start"},                /* 226 */ /* 0xC9 */
-    {0x02, "commit"},
-    {0x04, "aborted"},
-    {0x08, "aborted_mem"},
-    {0x10, "aborted_timer"},
-    {0x20, "aborted_unfriendly"},
-    {0x40, "aborted_memtype"},
-    {0x80, "aborted_events"},
-    {0x00, NULL},
-    {0x02, "x87_output"},           /* 235 */ /* 0xCA */
-    {0x04, "x87_input"},
-    {0x08, "simd_output"},
-    {0x10, "simd_input"},
-    {0x1E, "any"},
-    {0x00, NULL},
-    {0x20, "lbr_inserts"},          /* 241 */ /* 0xCC */
-    {0x00, NULL},
-    {0x11, "stlb_miss_loads"},      /* 243 */ /* 0xD0 */
-    {0x12, "stlb_miss_stores"},
-    {0x21, "lock_loads"},
-    {0x41, "split_loads"},
-    {0x42, "split_stores"},
-    {0x81, "all_loads"},
-    {0x82, "all_stores"},
-    {0x00, NULL},
-    {0x01, "l1_hit"},               /* 251 */ /* 0xD1 */
-    {0x02, "l2_hit"},
-    {0x04, "l3_hit"},
-    {0x08, "l1_miss"},
-    {0x10, "l2_miss"},
-    {0x20, "l3_miss"},
-    {0x40, "hit_lfb"},
-    {0x00, NULL},
-    {0x01, "xsnp_miss"},            /* 259 */ /* 0xD2 */
-    {0x02, "xsnp_hit"},
-    {0x04, "xsnp_hitm"},
-    {0x08, "xsnp_none"},
-    {0x00, NULL},
-    {0x01, "local_dram"},           /* 264 */ /* 0xD3 */
-    {0x00, NULL},
-    {0x1F, "any"},                  /* 266 */ /* 0xE6 */
-    {0x00, NULL},
-    {0x01, "demand_data_rd"},       /* 268 */ /* 0xF0 */
-    {0x02, "rfo"},
-    {0x04, "code_rd"},
-    {0x08, "all_pf"},
-    {0x10, "l1d_wb"},
-    {0x20, "l2_fill"},
-    {0x40, "l2_wb"},
-    {0x80, "all_requests"},
-    {0x00, NULL},
-    {0x01, "i"},                    /* 277 */ /* 0xF1 */
-    {0x02, "s"},
-    {0x04, "e"},
-    {0x07, "all"},
-    {0x00, NULL},
-    {0x05, "demand_clean"},         /* 282 */ /* 0xF2 */
-    {0x06, "demand_dirty"},
-    {0x00, NULL}
-};
-static const struct EVENT EVENT_LIST[256]      = {
-    {0x03, &UMASK_LIST[   0], "ld_blocks"},
-    {0x05, &UMASK_LIST[   3], "misalign_mem_ref"},
-    {0x07, &UMASK_LIST[   6], "ld_blocks_partial"},
-    {0x08, &UMASK_LIST[   8], "dtlb_load_misses"},
-    {0x0D, &UMASK_LIST[  18], "int_misc"},
-    {0x0E, &UMASK_LIST[  20], "uops_issued"},
-    {0x24, &UMASK_LIST[  25], "l2_rqsts"},
-    {0x27, &UMASK_LIST[  42], "l2_demand_rqsts"},
-    {0x2E, &UMASK_LIST[  44], "llc"},
-    {0x3C, &UMASK_LIST[  47], "cpu_clk_unhalted"},
-    {0x48, &UMASK_LIST[  50], "l1d_pend_miss"},
-    {0x49, &UMASK_LIST[  52], "dtlb_store_misses"},
-    {0x4C, &UMASK_LIST[  62], "load_hit_pre"},
-    {0x51, &UMASK_LIST[  65], "l1d"},
-    {0x54, &UMASK_LIST[  67], "tx_mem"},
-    {0x58, &UMASK_LIST[  75], "move_elimination"},
-    {0x5C, &UMASK_LIST[  80], "cpl_cycles"},
-    {0x5D, &UMASK_LIST[  83], "tx_exec"},
-    {0x5E, &UMASK_LIST[  89], "rs_events"},
-    {0x60, &UMASK_LIST[  91], "offcore_requests_outstanding"},
-    {0x63, &UMASK_LIST[  96], "lock_cycles"},
-    {0x79, &UMASK_LIST[  99], "idq"},
-    {0x80, &UMASK_LIST[ 111], "icache"},
-    {0x85, &UMASK_LIST[ 113], "itlb_misses"},
-    {0x87, &UMASK_LIST[ 122], "ild_stall"},
-    {0x88, &UMASK_LIST[ 125], "br_inst_exec"},
-    {0x89, &UMASK_LIST[ 135], "br_misp_exec"},
-    {0x9C, &UMASK_LIST[ 144], "idq_uops_not_delivered"},
-    {0xA1, &UMASK_LIST[ 146], "uops_executed_port"},
-    {0xA2, &UMASK_LIST[ 155], "resource_stalls"},
-    {0xA3, &UMASK_LIST[ 160], "cycle_activity"},
-    {0xA8, &UMASK_LIST[ 166], "lsd"},
-    {0xAE, &UMASK_LIST[ 168], "itlb"},
-    {0xB0, &UMASK_LIST[ 170], "offcore_requests"},
-    {0xB1, &UMASK_LIST[ 175], "uops_executed"},
-    /* Ghost [0xB7] and [0xBB] OFF_CORE_RESPONSE_[01] */
-    {0xBC, &UMASK_LIST[ 177], "page_walker_loads"},
-    {0xBD, &UMASK_LIST[ 186], "tlb_flush"},
-    {0xC0, &UMASK_LIST[ 189], "inst_retired"},
-    {0xC1, &UMASK_LIST[ 192], "other_assists"},
-    {0xC2, &UMASK_LIST[ 196], "uops_retired"},
-    {0xC3, &UMASK_LIST[ 199], "machine_clears"},
-    {0xC4, &UMASK_LIST[ 203], "br_inst_retired"},
-    {0xC5, &UMASK_LIST[ 212], "br_misp_retired"},
-    {0xC8, &UMASK_LIST[ 217], "hle_retired"},
-    {0xC9, &UMASK_LIST[ 226], "rtm_retired"},
-    {0xCA, &UMASK_LIST[ 235], "fp_assist"},
-    {0xCC, &UMASK_LIST[ 241], "rob_misc_events"},
-    /* Ghost [0xCD] MEM_TRANS_RETIRED */
-    {0xD0, &UMASK_LIST[ 243], "mem_uops_retired"},
-    {0xD1, &UMASK_LIST[ 251], "mem_load_uops_retired"},
-    {0xD2, &UMASK_LIST[ 259], "mem_load_uops_l3_hit_retired"},
-    {0xD3, &UMASK_LIST[ 264], "mem_load_uops_l3_miss_retired"},
-    {0xE6, &UMASK_LIST[ 266], "baclears"},
-    {0xF0, &UMASK_LIST[ 268], "l2_trans"},
-    {0xF1, &UMASK_LIST[ 277], "l2_lines_in"},
-    {0xF2, &UMASK_LIST[ 282], "l2_lines_out"},
-    {0x00, NULL             , NULL}
+/**
+ * MSR_OFFCORE_RSP_x presets. Requests are bits 15:0, responses bits 37:16:
+ * Supplier in 30:16 (L3 hits in 21:18, local DRAM 26, remote DRAM 29:27),
+ * snoop result in 37:31. Only request bit 10 differs between Skylake
+ * (PF_L1D_AND_SW, part of all_data_rd) and Haswell/Broadwell (BUS_LOCKS).
+ */
+
+static const OFFCORE      OFFCORE_PRESETS[] = {
+	{"demand_data_rd", 0x0000000001ULL, 0x0000000001ULL},
+	{"demand_rfo",     0x0000000002ULL, 0x0000000002ULL},
+	{"demand_code_rd", 0x0000000004ULL, 0x0000000004ULL},
+	{"all_data_rd",    0x0000000491ULL, 0x0000000091ULL},
+	{"all_rfo",        0x0000000122ULL, 0x0000000122ULL},
+	{"any_response",   0x0000010000ULL, 0x0000010000ULL},
+	{"llc_hit",        0x3F803C0000ULL, 0x3F803C0000ULL},
+	{"llc_hit_snoop",  0x18003C0000ULL, 0x18003C0000ULL},
+	{"local_dram",     0x3F84000000ULL, 0x3F84000000ULL},
+	{"remote_dram",    0x3FB8000000ULL, 0x3FB8000000ULL},
+	{NULL,             0,               0}
 };
+
 static const char* const  PFC_ERROR_MESSAGES[] = {
 	[-PFC_ERR_OK]              = "Success",
 	[-PFC_ERR_OPENING_SYSFILE] = "Error opening the /sys/module/pfc files. Is the kernel module loaded?",
@@ -393,6 +81,9 @@ static const char* const  PFC_ERROR_MESSAGES[] = {
 	[-PFC_ERR_CR4_PCE_NOT_SET] = "CR4.PCE not set. Try echo 2 > /sys/bus/event_source/devices/cpu/rdpmc.",
 	[-PFC_ERR_AFFINITY_FAILED] = "Setting CPU affinity failed (perhaps affinity is set externally excluding CPU 0?)",
 	[-PFC_ERR_READING_MASKS]   = "Didn't read the expected number of mask bytes from the sysfs",
+	[-PFC_ERR_OFFCORE_UNSET]   = "Offcore response event configured before its MSR_OFFCORE_RSP_x (see pfcWrOffcore()), or unsupported on this CPU.",
+	[-PFC_ERR_UNKNOWN_EVENT]   = "Unknown event name.",
+	[-PFC_ERR_CFG_REJECTED]    = "pfc.ko disabled a requested event (restricted to other counters, or unsupported on this CPU).",
 };
 
 /* Function Definitions */
@@ -407,6 +98,13 @@ int       pfcInit          (void){
 	cntFd = open("/sys/module/pfc/counts",  O_RDWR   | O_CLOEXEC);
 	msrFd = open("/sys/module/pfc/msr",     O_RDONLY | O_CLOEXEC);
 	cr4Fd = open("/sys/module/pfc/cr4.pce", O_RDONLY | O_CLOEXEC);
+	
+	/* Optional; Older modules lack them. */
+	slotsFd = open("/sys/module/pfc/slots", O_RDWR   | O_CLOEXEC);
+	slotFd  = open("/sys/module/pfc/slot",  O_RDWR   | O_CLOEXEC);
+	muxFd   = open("/sys/module/pfc/mux",   O_RDWR   | O_CLOEXEC);
+	rmtFd   = open("/sys/module/pfc/remote", O_RDONLY | O_CLOEXEC);
+	offFd   = open("/sys/module/pfc/offcore", O_RDWR | O_CLOEXEC);
 
 	/**
 	 * If failed to open, abort.
@@ -455,6 +153,16 @@ void      pfcFini          (void){
 	msrFd = -1;
 	close(cr4Fd);
 	cr4Fd = -1;
+	close(slotsFd);
+	slotsFd = -1;
+	close(slotFd);
+	slotFd = -1;
+	close(muxFd);
+	muxFd = -1;
+	close(rmtFd);
+	rmtFd = -1;
+	close(offFd);
+	offFd = -1;
 }
 
 int      pfcPinThread     (int core){
@@ -467,9 +175,208 @@ int      pfcPinThread     (int core){
 	return 0;
 }
 
+/**
+ * Mask of the configurations that a write returning actual wrote whole.
+ */
+
+static uint8_t pfcWrittenMask(ssize_t actual){
+	return actual <= 0                          ? 0    :
+	       actual >= 8*(ssize_t)sizeof(PFC_CFG) ? 0xFF :
+	       (1u << actual/sizeof(PFC_CFG)) - 1;
+}
+
+/**
+ * Patch the image img/known (bit i set if img[i] is known) of counters 0-6
+ * with the n configurations starting at counter k in cfg, of which those in
+ * mask are known. Returns the updated known mask.
+ */
+
+static uint8_t pfcPatchCfgs(PFC_CFG* img, uint8_t known, int k, int n,
+                            const PFC_CFG* cfg, uint8_t mask){
+	int i;
+
+	for(i=0;i<n && k+i<7;i++){
+		known &= ~(1 << (k+i));
+		if(mask & (1 << i)){
+			img[k+i] = cfg[i];
+			known   |= 1 << (k+i);
+		}
+	}
+	return known;
+}
+
+/**
+ * Record the configurations that the calling thread just wrote to counters k
+ * to k+n-1 of its CPU, of which those in mask were accepted, as seen by
+ * pfcRdCpu() before (cpu) and after (cpuAfter) the write; If it migrated
+ * meanwhile, which CPU got what is unknown. The signature is computed from
+ * these values alone, so that no configuration write pays for a read-back.
+ */
+
+static void pfcNoteCfgs(uint32_t cpu, uint32_t cpuAfter, int k, int n,
+                        const PFC_CFG* cfg, uint8_t mask){
+	uint64_t sig = 0xCBF29CE484222325ULL;
+	int      i;
+
+	if(cpu != cpuAfter){
+		if(cpuAfter < MAXCPU){
+			cfgKnown[cpuAfter] = 0;
+			__atomic_store_n(&cfgSigs[cpuAfter], 0, __ATOMIC_RELAXED);
+		}
+		mask = 0;
+	}
+	if(cpu >= MAXCPU){
+		return;
+	}
+	cfgKnown[cpu] = pfcPatchCfgs(cfgImgs[cpu], cpu == cpuAfter ? cfgKnown[cpu] : 0,
+	                             k, n, cfg, mask);
+	if(cfgKnown[cpu] != 0x7F){
+		sig = 0;
+	}else{
+		/* FNV-1a over the configurations; Never 0, which means unknown. */
+		for(i=0;i<7;i++){
+			sig ^= cfgImgs[cpu][i];
+			sig *= 0x100000001B3ULL;
+		}
+		sig |= 1;
+	}
+	__atomic_store_n(&cfgSigs[cpu], sig, __ATOMIC_RELAXED);
+}
+
+/**
+ * Whether any of the n configurations starting at counter k enables an
+ * offcore response event whose MSR_OFFCORE_RSP_x, on the calling thread's
+ * CPU, selects no request or is unsupported, which pfc.ko would silently
+ * disable. Only reads the MSRs if such an event is present.
+ */
+
+static int  pfcOffcoreUnset(int k, int n, const PFC_CFG* cfg){
+	uint64_t rsp[2];
+	int      i, evtNum, need = 0;
+
+	for(i=0;i<n;i++){
+		evtNum = cfg[i] & 0xFF;
+		if(k+i >= 3 && (cfg[i] & (1ULL << 22)) && (evtNum == 0xB7 || evtNum == 0xBB)){
+			need |= evtNum == 0xB7 ? 1 : 2;
+		}
+	}
+	if(!need || offFd < 0){
+		return 0;
+	}
+	if(pfcRdOffcore(0, 2, rsp) != sizeof(rsp)){
+		return 1;/* pfc.ko does not support them on this model. */
+	}
+	return ((need & 1) && !(rsp[0] & 0xFFFF)) ||
+	       ((need & 2) && !(rsp[1] & 0xFFFF));
+}
+
 int       pfcWrCfgs        (int k, int n, const PFC_CFG* cfg){
-    ssize_t wrSize = sizeof(*cfg)*n;
-    ssize_t actual = pwrite(cfgFd, cfg, wrSize, k*sizeof(*cfg));
+    ssize_t  wrSize = sizeof(*cfg)*n;
+    ssize_t  actual;
+    uint32_t cpu;
+	
+	if(pfcOffcoreUnset(k, n, cfg)){
+		return PFC_ERR_OFFCORE_UNSET;
+	}
+	cpu    = pfcRdCpu();
+	actual = pwrite(cfgFd, cfg, wrSize, k*sizeof(*cfg));
+	pfcNoteCfgs(cpu, pfcRdCpu(), k, n, cfg, pfcWrittenMask(actual));
+	if (actual == -1) {
+	    return PFC_ERR_PWRITE_FAILED;
+	} else if (actual < wrSize) {
+	    return PFC_ERR_PWRITE_TOO_FEW;
+	}
+	return 0;
+}
+int       pfcWrCfgsAll     (int k, int n, const PFC_CFG* cfg){
+	cpu_set_t saved;
+	int       cpu, ret = 0, err;
+
+	if(sched_getaffinity(0, sizeof(saved), &saved) == -1){
+		return PFC_ERR_AFFINITY_FAILED;
+	}
+	for(cpu=0;cpu<CPU_SETSIZE;cpu++){
+		if(!CPU_ISSET(cpu, &saved)){
+			continue;
+		}
+		if((err = pfcPinThread(cpu)) || (err = pfcWrCfgs(k, n, cfg))){
+			ret = ret ? ret : err;
+		}
+	}
+	if(sched_setaffinity(0, sizeof(saved), &saved) == -1){
+		return PFC_ERR_AFFINITY_FAILED;
+	}
+	return ret;
+}
+int       pfcRdCntsOn      (int cpu, int k, int n, PFC_CNT* cnt){
+	if(rmtFd < 0){
+		return PFC_ERR_OPENING_SYSFILE;
+	}
+	if(cpu < 0 || k < 0 || n < 0 || k+n > PFC_ABI_REMOTE_NCNT){
+		return -1;
+	}
+	return pread(rmtFd, cnt, sizeof(*cnt)*n,
+	             (off_t)cpu*PFC_ABI_REMOTE_STRIDE + k*sizeof(*cnt));
+}
+int       pfcRdCntsOnSet   (const int* cpus, int ncpus, PFC_CNT (*cnt)[7]){
+	const int perWin = PFC_ABI_REMOTE_WINDOW/PFC_ABI_REMOTE_STRIDE;
+	PFC_CNT*  rows;
+	ssize_t   size;
+	off_t     off;
+	int       i, lo, hi, w, ret = 0;
+	
+	if(rmtFd < 0){
+		return PFC_ERR_OPENING_SYSFILE;
+	}
+	if(ncpus <= 0){
+		return ncpus == 0 ? 0 : -1;
+	}
+	
+	/**
+	 * Read the span of CPU numbers one window at a time, aligned to the pages
+	 * sysfs splits reads at, so that the kernel interrupts the CPUs of each
+	 * window together; Then pick out the requested rows.
+	 */
+	
+	for(lo=hi=cpus[0],i=1;i<ncpus;i++){
+		lo = cpus[i] < lo ? cpus[i] : lo;
+		hi = cpus[i] > hi ? cpus[i] : hi;
+	}
+	if(lo < 0){
+		return -1;
+	}
+	lo -= lo % perWin;
+	if(!(rows = malloc((size_t)(hi-lo+1)*PFC_ABI_REMOTE_STRIDE))){
+		return -1;
+	}
+	for(w=lo;w<=hi && ret==0;w+=perWin){
+		size = (ssize_t)(hi-w+1 < perWin ? hi-w+1 : perWin)*PFC_ABI_REMOTE_STRIDE;
+		off  = (off_t)w*PFC_ABI_REMOTE_STRIDE;
+		if(pread(rmtFd, rows + (w-lo)*PFC_ABI_REMOTE_NCNT, size, off) != size){
+			ret = -1;
+		}
+	}
+	for(i=0;i<ncpus && ret==0;i++){
+		memcpy(cnt[i], rows + (cpus[i]-lo)*PFC_ABI_REMOTE_NCNT, sizeof(cnt[i]));
+	}
+	free(rows);
+	return ret;
+}
+int       pfcLoadSlot      (int s, int k, int n, const PFC_CFG* cfg){
+	ssize_t wrSize = sizeof(*cfg)*n;
+	ssize_t actual;
+	
+	if(slotsFd < 0){
+		return PFC_ERR_OPENING_SYSFILE;
+	}
+	if(s < 0 || s >= PFC_ABI_NSLOTS || k < 0 || n < 0 || k+n > PFC_ABI_MAXPMC){
+		return PFC_ERR_PWRITE_FAILED;
+	}
+	actual = pwrite(slotsFd, cfg, wrSize, (s*PFC_ABI_MAXPMC + k)*sizeof(*cfg));
+	if(k < 7){
+		slotKnown[s] = pfcPatchCfgs(slotImgs[s], slotKnown[s], k, n, cfg,
+		                            pfcWrittenMask(actual));
+	}
 	if (actual == -1) {
 	    return PFC_ERR_PWRITE_FAILED;
 	} else if (actual < wrSize) {
@@ -477,6 +384,78 @@ int       pfcWrCfgs        (int k, int n, const PFC_CFG* cfg){
 	}
 	return 0;
 }
+int       pfcSwitchSlot    (int s){
+	uint64_t slot = s;
+	uint32_t cpu;
+	ssize_t  actual;
+	
+	if(slotFd < 0){
+		return PFC_ERR_OPENING_SYSFILE;
+	}
+	if(s < 0 || s >= PFC_ABI_NSLOTS){
+		return PFC_ERR_PWRITE_FAILED;
+	}
+	cpu    = pfcRdCpu();
+	actual = pwrite(slotFd, &slot, sizeof(slot), 0);
+	pfcNoteCfgs(cpu, pfcRdCpu(), 0, 7, slotImgs[s],
+	            actual == (ssize_t)sizeof(slot) ? slotKnown[s] : 0);
+	if (actual == -1) {
+	    return PFC_ERR_PWRITE_FAILED;
+	} else if (actual < (ssize_t)sizeof(slot)) {
+	    return PFC_ERR_PWRITE_TOO_FEW;
+	}
+	return 0;
+}
+int       pfcMuxStart      (int groups, uint64_t periodNs){
+	uint64_t ctl[2] = {groups, periodNs};
+	ssize_t  actual;
+	
+	if(muxFd < 0){
+		return PFC_ERR_OPENING_SYSFILE;
+	}
+	if(groups < 0 || groups > PFC_ABI_NSLOTS){
+		return PFC_ERR_PWRITE_FAILED;
+	}
+	actual = pwrite(muxFd, ctl, sizeof(ctl), 0);
+	if (actual == -1) {
+	    return PFC_ERR_PWRITE_FAILED;
+	} else if (actual < (ssize_t)sizeof(ctl)) {
+	    return PFC_ERR_PWRITE_TOO_FEW;
+	}
+	return 0;
+}
+int       pfcMuxStop       (void){
+	return pfcMuxStart(0, 0);
+}
+int       pfcMuxRead       (PFC_MUX* m){
+	uint64_t        img[PFC_ABI_MUX_SIZE];
+	const uint64_t* row;
+	int             g, k;
+	
+	if(pread(muxFd, img, sizeof(img), 0) != sizeof(img)){
+		return -1;
+	}
+	
+	memset(m, 0, sizeof(*m));
+	m->groups    = (int)img[0];
+	m->periodNs  = img[1];
+	m->enabledNs = img[2];
+	for(g=0;g<PFC_ABI_NSLOTS;g++){
+		row             = img + PFC_ABI_MUX_HDR + g*PFC_ABI_MUX_STRIDE;
+		m->runningNs[g] = row[0];
+		for(k=0;k<7;k++){
+			m->raw[g][k] = row[1+k];
+			m->est[g][k] = row[0] ? (double)row[1+k] * m->enabledNs / row[0] : 0;
+		}
+	}
+	return 0;
+}
+uint64_t  pfcCfgSignature  (int cpu){
+	if(cpu < 0 || cpu >= MAXCPU){
+		return 0;
+	}
+	return __atomic_load_n(&cfgSigs[cpu], __ATOMIC_RELAXED);
+}
 int       pfcRdCfgs        (int k, int n,       PFC_CFG* cfg){
 	return pread (cfgFd, cfg, sizeof(*cfg)*n, k*sizeof(*cfg));
 }
@@ -486,6 +465,13 @@ int       pfcWrCnts        (int k, int n, const PFC_CNT* cnt){
 int       pfcRdCnts        (int k, int n,       PFC_CNT* cnt){
 	return pread (cntFd, cnt, sizeof(*cnt)*n, k*sizeof(*cnt));
 }
+int       pfcRdMasks       (int k, int n,       uint64_t* msk){
+	if(k < 0 || n < 0 || k+n > 7){
+		return -1;
+	}
+	memcpy(msk, masks+k, n*sizeof(*msk));
+	return n*sizeof(*msk);
+}
 int       pfcRdMSR         (uint64_t off,       uint64_t* msr){
 	return pread (msrFd, msr, sizeof(*msr), off);
 }
@@ -525,19 +511,19 @@ uint64_t  pfcParseCfg      (const char* s){
 	 * Find event number and umask list.
 	 */
 	
-	while(EVENT_LIST[i].name){
-		int n = strlen(EVENT_LIST[i].name);
-		if(strncasecmp(s, EVENT_LIST[i].name, n) == 0 && s[n] == '.'){
+	while(PFC_EVENT_LIST[i].name){
+		int n = strlen(PFC_EVENT_LIST[i].name);
+		if(strncasecmp(s, PFC_EVENT_LIST[i].name, n) == 0 && s[n] == '.'){
 			/* Found it. */
-			evtNum      = EVENT_LIST[i].evtNum;
-			umaskList   = EVENT_LIST[i].umasks;
+			evtNum      = PFC_EVENT_LIST[i].evtNum;
+			umaskList   = PFC_EVENT_LIST[i].umasks;
 			s          += n+1;
 			break;
 		}
 		
 		i++;
 	}
-	if(!EVENT_LIST[i].name){
+	if(!PFC_EVENT_LIST[i].name){
 		/* We didn't find the event by name. Parse as integer. */
 		evtNum = strtoull(s, (char**)&s, 0);
 		if(s[0] != '.' || evtNum > 0xFF){
@@ -546,10 +532,10 @@ uint64_t  pfcParseCfg      (const char* s){
 		s++;
 		
 		i=0;
-		while(EVENT_LIST[i].name){
-			if(EVENT_LIST[i].evtNum == evtNum){
+		while(PFC_EVENT_LIST[i].name){
+			if(PFC_EVENT_LIST[i].evtNum == evtNum){
 				/* Found it. */
-				umaskList   = EVENT_LIST[i].umasks;
+				umaskList   = PFC_EVENT_LIST[i].umasks;
 				break;
 			}
 			
@@ -570,7 +556,7 @@ uint64_t  pfcParseCfg      (const char* s){
 	while(umaskList[i].name){
 		int n = strlen(umaskList[i].name);
 		if(strncasecmp(s, umaskList[i].name, n) == 0 &&
-		   (s[n] == '\0' || s[n] == '<' || (s[n] == '>' && s[n+1] == '=') || s[n] == ':')){
+		   (s[n] == '\0' || s[n] == '<' || (s[n] == '>' && s[n+1] == '=') || s[n] == ':' || s[n] == '@')){
 			/* Found it. */
 			umaskVal  = umaskList[i].umaskVal;
 			s        += n;
@@ -581,7 +567,7 @@ uint64_t  pfcParseCfg      (const char* s){
 	}
 	if(!umaskList[i].name){
 		umaskVal = strtoull(s, (char**)&s, 0);
-		if(umaskVal > 0xFF || (s[0] != '\0' && s[0] != '<' && !(s[0] == '>' && s[1] == '=') && s[0] != ':')){
+		if(umaskVal > 0xFF || (s[0] != '\0' && s[0] != '<' && !(s[0] == '>' && s[1] == '=') && s[0] != ':' && s[0] != '@')){
 			/* Parsing umask as an integer made no sense. */
 			return 0;
 		}
@@ -634,8 +620,99 @@ uint64_t  pfcParseCfg      (const char* s){
 	return cfg;
 }
 
+/**
+ * Whether the calling CPU uses the Haswell/Broadwell offcore request encoding.
+ */
+
+static int      pfcOffcoreHsw    (void){
+	unsigned a, b, c, d, dispModel;
+
+	__cpuid(1, a, b, c, d);
+	dispModel = ((a >> 4) & 0x0F) | ((a >> 12) & 0xF0);
+	switch(dispModel){
+		case 0x3C: case 0x3F: case 0x45: case 0x46:/* Haswell */
+		case 0x3D: case 0x47: case 0x4F: case 0x56:/* Broadwell */
+		return ((a >> 8) & 0x0F) == 0x06;
+		default:
+		return 0;
+	}
+}
+
+uint64_t  pfcParseOffcore  (const char* s){
+	const OFFCORE* p;
+	const char*    at;
+	uint64_t       rsp = 0;
+	size_t         n;
+	int            hsw = pfcOffcoreHsw();
+	
+	if(!s){
+		return 0;
+	}
+	if((at = strchr(s, '@'))){
+		s = at+1;
+	}
+	
+	while(*s){
+		for(p=OFFCORE_PRESETS;p->name;p++){
+			n = strlen(p->name);
+			if(strncasecmp(s, p->name, n) == 0 &&
+			   (s[n] == '\0' || s[n] == '+')){
+				rsp |= hsw ? p->rspHsw : p->rsp;
+				s   += n;
+				break;
+			}
+		}
+		if(!p->name){
+			if(!isdigit(*s)){
+				return 0;
+			}
+			rsp |= strtoull(s, (char**)&s, 0);
+		}
+		if(*s == '+'){
+			s++;
+		}else if(*s){
+			return 0;
+		}
+	}
+	
+	/**
+	 * With no request, count all data reads; With no response, count any.
+	 */
+	
+	if(rsp && !(rsp & 0xFFFF)){
+		rsp |= hsw ? 0x091 : 0x491;/* all_data_rd */
+	}
+	if(rsp && !(rsp & 0x3FFFFF0000ULL)){
+		rsp |= 0x10000;/* any_response */
+	}
+	return rsp;
+}
+
+int       pfcWrOffcore     (int k, int n, const uint64_t* rsp){
+	ssize_t wrSize = sizeof(*rsp)*n;
+	ssize_t actual;
+	
+	if(offFd < 0){
+		return PFC_ERR_OPENING_SYSFILE;
+	}
+	actual = pwrite(offFd, rsp, wrSize, k*sizeof(*rsp));
+	if (actual == -1) {
+	    return PFC_ERR_PWRITE_FAILED;
+	} else if (actual < wrSize) {
+	    return PFC_ERR_PWRITE_TOO_FEW;
+	}
+	return 0;
+}
+
+int       pfcRdOffcore     (int k, int n,       uint64_t* rsp){
+	if(offFd < 0){
+		return PFC_ERR_OPENING_SYSFILE;
+	}
+	return pread(offFd, rsp, sizeof(*rsp)*n, k*sizeof(*rsp));
+}
+
 void      pfcDumpEvts      (void){
-	const EVENT* evt   = EVENT_LIST;
+	const EVENT* evt   = PFC_EVENT_LIST;
 	const UMASK* umask;
 	
 	printf("Available events:\n");
@@ -653,36 +730,60 @@ void      pfcDumpEvts      (void){
 }
 
 void      pfcRemoveBias     (PFC_CNT* b, int64_t mul){
+	pfcRemoveBiasSer(b, mul, PFC_SER_LFENCE);
+}
+
+void      pfcRemoveBiasSer  (PFC_CNT* b, int64_t mul, int pol){
 	PFC_CNT  warmup[7] = {0,0,0,0,0,0,0};
 	int      i;
 	
-	for(i=0;i<10;i++){
-		/**
-		 * This code sequence is the opposite of PFCSTART/PFCEND: It adds, then
-		 * subtracts. The net effect is a subtraction by an amount equal to the
-		 * bias.
-		 * 
-		 * We execute this loop 10 times to ensure the loop and warmup buffer
-		 * are both "hot" and the branch predictor is settled, then break out
-		 * of the loop and apply the computed bias to the argument buffer.
-		 */
-		
-		memset(warmup, 0, sizeof(warmup));
-		asm volatile(
-		_pfc_asm_code_(add)
-		_pfc_asm_code_(sub)
-		:               /* Outputs */
-		: "r"((warmup)) /* Inputs */
-		: "memory", "rax", "rcx", "rdx"
-		);
+	/**
+	 * This code sequence is the opposite of PFCSTART/PFCEND: It adds, then
+	 * subtracts. The net effect is a subtraction by an amount equal to the
+	 * bias.
+	 * 
+	 * We execute this loop 10 times to ensure the loop and warmup buffer
+	 * are both "hot" and the branch predictor is settled, then break out
+	 * of the loop and apply the computed bias to the argument buffer.
+	 * 
+	 * Each serialization policy gets its own copy of the loop, since the
+	 * sequence must match the one used in the measured region exactly.
+	 */
+	
+#define _pfc_bias_loop_(pol)                        \
+	for(i=0;i<10;i++){                              \
+		memset(warmup, 0, sizeof(warmup));          \
+		asm volatile(                               \
+		_pfc_asm_code_ser_(add, pol)                \
+		_pfc_asm_code_ser_(sub, pol)                \
+		:               /* Outputs */               \
+		: "r"((warmup)) /* Inputs */                \
+		: _pfc_clobbers_##pol                       \
+		);                                          \
 	}
 	
+	switch(pol){
+		case PFC_SER_NONE:   _pfc_bias_loop_(NONE);   break;
+		case PFC_SER_LFENCE: _pfc_bias_loop_(LFENCE); break;
+		case PFC_SER_MFENCE: _pfc_bias_loop_(MFENCE); break;
+		case PFC_SER_CPUID:  _pfc_bias_loop_(CPUID);  break;
+		case PFC_SER_RDTSCP: _pfc_bias_loop_(RDTSCP); break;
+		default:             return;
+	}
+	
+#undef _pfc_bias_loop_
+	
 	for(i=0;i<7;i++){
 		b[i] += warmup[i]*mul;
 		b[i] &= masks[i];
 	}
 }
 
+void      pfcBaseInit       (PFC_BASE* b){
+	memset(b->cnt, 0, sizeof(b->cnt));
+	memcpy(b->msk, masks, sizeof(b->msk));
+}
+
 const char *pfcErrorString(int err) {
 	if(-err >= sizeof(PFC_ERROR_MESSAGES)/sizeof(PFC_ERROR_MESSAGES[0])){
 		return "Unknown Error";
@@ -0,0 +1,208 @@
+/* Includes */
+#include "libpfc.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <x86intrin.h>
+
+
+/* Defines */
+#define AB_WARMUP               8
+#define AB_RESAMPLES            1000
+#define AB_ALPHA                0.05
+
+
+/* Data Structures */
+struct RANKED;
+typedef struct RANKED RANKED;
+
+struct RANKED{
+	double v;
+	int    fromA;
+};
+
+
+
+/* Static Function Definitions */
+
+static int             pfcABCmp         (const void* a, const void* b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static int             pfcABCmpRanked   (const void* a, const void* b){
+	return pfcABCmp(&((const RANKED*)a)->v, &((const RANKED*)b)->v);
+}
+
+/**
+ * Median of the n values of x, which it sorts.
+ */
+
+static double          pfcABMedian      (double* x, size_t n){
+	qsort(x, n, sizeof(*x), pfcABCmp);
+	return n&1 ? x[n/2] : (x[n/2-1]+x[n/2])/2;
+}
+
+static uint64_t        pfcABRand        (uint64_t* s){
+	*s ^= *s << 13;
+	*s ^= *s >>  7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/**
+ * Two-sided p-value of the Mann-Whitney U test of a against b, both of n
+ * samples, by the normal approximation with tie correction.
+ */
+
+static double          pfcABMannWhitney (const double* a, const double* b, size_t n, RANKED* r){
+	double rankA = 0, ties = 0, t, u, mu, sigma, z;
+	size_t i, j, k, N = 2*n;
+
+	for(i=0;i<n;i++){
+		r[i  ].v = a[i]; r[i  ].fromA = 1;
+		r[n+i].v = b[i]; r[n+i].fromA = 0;
+	}
+	qsort(r, N, sizeof(*r), pfcABCmpRanked);
+
+	/* Tied values all get the mean of their ranks. */
+	for(i=0;i<N;i=j){
+		for(j=i+1;j<N && r[j].v == r[i].v;j++){}
+		t = j-i;
+		for(k=i;k<j;k++){
+			rankA += r[k].fromA ? (i+j+1)/2.0 : 0;
+		}
+		ties  += t*t*t - t;
+	}
+
+	u     = rankA - n*(n+1)/2.0;
+	mu    = n*(double)n/2;
+	sigma = sqrt(n*(double)n/12 * ((N+1) - ties/(N*(N-1.0))));
+	if(sigma <= 0){
+		return 1;
+	}
+	z = (fabs(u-mu) - 0.5)/sigma;
+	return z <= 0 ? 1 : erfc(z/sqrt(2));
+}
+
+
+/**
+ * Run and analyze the A/B comparison, into the scratch buffers sa and sb
+ * (7*n), d and tmp (n), boot (AB_RESAMPLES) and rk (2*n).
+ */
+
+static void            pfcABRun         (void (*a)(void*), void (*b)(void*), void* arg,
+                                         size_t n, PFC_AB* r,
+                                         double* sa, double* sb, double* d,
+                                         double* tmp, double* boot, RANKED* rk){
+	PFC_CNT  cnt[7];
+	uint64_t seed = __rdtsc() | 1;
+	size_t   i, j;
+	int      k, bFirst;
+
+
+	/**
+	 * Run a and b once each per iteration, in random order, so that drift in
+	 * frequency or temperature affects both alike.
+	 */
+
+	for(i=0;i<AB_WARMUP;i++){
+		a(arg);
+		b(arg);
+	}
+	for(i=0;i<n;i++){
+		bFirst = pfcABRand(&seed) & 1;
+		for(j=0;j<2;j++){
+			memset(cnt, 0, sizeof(cnt));
+			PFCSTART(cnt);
+			(j ^ bFirst ? b : a)(arg);
+			PFCEND(cnt);
+			pfcRemoveBias(cnt, 1);
+			for(k=0;k<7;k++){
+				(j ^ bFirst ? sb : sa)[k*n+i] = cnt[k];
+			}
+		}
+	}
+
+
+	/**
+	 * Per counter: Medians, the median paired difference with a percentile
+	 * bootstrap interval, and the rank test.
+	 */
+
+	r->n = n;
+	for(k=0;k<7;k++){
+		for(i=0;i<n;i++){
+			d[i] = sb[k*n+i] - sa[k*n+i];
+		}
+		for(j=0;j<AB_RESAMPLES;j++){
+			for(i=0;i<n;i++){
+				tmp[i] = d[pfcABRand(&seed) % n];
+			}
+			boot[j] = pfcABMedian(tmp, n);
+		}
+		qsort(boot, AB_RESAMPLES, sizeof(*boot), pfcABCmp);
+		r->cnt[k].lo   = boot[(size_t)(AB_RESAMPLES*(AB_ALPHA/2))];
+		r->cnt[k].hi   = boot[(size_t)(AB_RESAMPLES*(1-AB_ALPHA/2))-1];
+		r->cnt[k].p    = pfcABMannWhitney(sa+k*n, sb+k*n, n, rk);
+		r->cnt[k].diff = pfcABMedian(d, n);
+		memcpy(tmp, sa+k*n, n*sizeof(*tmp));
+		r->cnt[k].medA = pfcABMedian(tmp, n);
+		memcpy(tmp, sb+k*n, n*sizeof(*tmp));
+		r->cnt[k].medB = pfcABMedian(tmp, n);
+		if(r->cnt[k].p < AB_ALPHA && (r->cnt[k].lo > 0 || r->cnt[k].hi < 0)){
+			r->cnt[k].verdict = r->cnt[k].diff < 0 ? -1 : +1;
+		}
+	}
+}
+
+
+/* Function Definitions */
+
+int       pfcAB            (void (*a)(void*), void (*b)(void*), void* arg,
+                            size_t n, PFC_AB* r){
+	double* sa, *sb, *d, *tmp, *boot;
+	RANKED* rk;
+	int     ret = -1;
+
+	memset(r, 0, sizeof(*r));
+	if(n < 2){
+		return -1;
+	}
+	sa   = malloc(7*n*sizeof(*sa));
+	sb   = malloc(7*n*sizeof(*sb));
+	d    = malloc(  n*sizeof(*d));
+	tmp  = malloc(  n*sizeof(*tmp));
+	boot = malloc(AB_RESAMPLES*sizeof(*boot));
+	rk   = malloc(2*n*sizeof(*rk));
+	if(sa && sb && d && tmp && boot && rk){
+		pfcABRun(a, b, arg, n, r, sa, sb, d, tmp, boot, rk);
+		ret = 0;
+	}
+	free(sa);
+	free(sb);
+	free(d);
+	free(tmp);
+	free(boot);
+	free(rk);
+	return ret;
+}
+
+void      pfcABDump        (const PFC_AB* r, const char* const* names){
+	const PFC_AB_CNT* c;
+	char              dflt[16];
+	int               k;
+
+	printf("%-32s %14s %14s %14s %25s %9s\n",
+	       "counter", "A", "B", "B-A", "95% CI", "p");
+	for(k=0;k<7;k++){
+		c = &r->cnt[k];
+		snprintf(dflt, sizeof(dflt), "counter %d", k);
+		printf("%-32s %14.1f %14.1f %14.1f [%11.1f,%11.1f] %9.2g  %s\n",
+		       names && names[k] ? names[k] : dflt,
+		       c->medA, c->medB, c->diff, c->lo, c->hi, c->p,
+		       c->verdict < 0 ? "B fewer" : c->verdict > 0 ? "B more" : "-");
+	}
+}
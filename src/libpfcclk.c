@@ -0,0 +1,283 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <cpuid.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <x86intrin.h>
+
+
+/* Defines */
+
+/**
+ * TSC calibration parameters: CALIB_ROUNDS windows of CALIB_NANOS each, of
+ * which the tightest-bracketed one is kept.
+ */
+
+#define CALIB_ROUNDS                      5
+#define CALIB_NANOS                20000000
+
+/**
+ * If CPUID-derived and measured TSC frequencies disagree by more than this
+ * ratio, the CPUID is lying (typically under a hypervisor); Trust the clock.
+ */
+
+#define CALIB_TOLERANCE                0.01
+
+
+/* Global data */
+static PFC_CLK        clk;
+static double         nsPerTsc  = 0;
+static double         nsPerCyc  = 0;
+static double         nsPerXclk = 0;
+static pthread_once_t clkOnce   = PTHREAD_ONCE_INIT;
+
+
+/* Static Function Definitions */
+
+/**
+ * Read the nanosecond-resolution raw monotonic clock.
+ */
+
+static int64_t  pfcClkMonoRaw    (void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (int64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Sample the TSC and the raw monotonic clock "simultaneously".
+ *
+ * The clock read is bracketed by two rdtscp's; The TSC value is taken as the
+ * midpoint and the bracket width is returned as the uncertainty.
+ */
+
+static uint64_t pfcClkSample     (int64_t* ns, uint64_t* tsc){
+	unsigned aux;
+	uint64_t t0, t1;
+
+	t0  = __rdtscp(&aux);
+	*ns = pfcClkMonoRaw();
+	t1  = __rdtscp(&aux);
+
+	*tsc = t0 + (t1-t0)/2;
+	return t1-t0;
+}
+
+/**
+ * Measure the TSC frequency against CLOCK_MONOTONIC_RAW.
+ *
+ * Each round busy-waits CALIB_NANOS between two samples, retrying each sample
+ * a few times to get a tight bracket. The round with the smallest combined
+ * bracket width is kept.
+ */
+
+static double   pfcClkMeasure    (void){
+	int      i, j;
+	int64_t  ns0 = 0, ns1 = 0, ns;
+	uint64_t tsc0 = 0, tsc1 = 0, tsc, w0, w1, w, best = ~0ULL;
+	double   hz = 0;
+
+	for(i=0;i<CALIB_ROUNDS;i++){
+		w0 = ~0ULL;
+		for(j=0;j<8;j++){
+			w = pfcClkSample(&ns, &tsc);
+			if(w < w0){w0 = w; ns0 = ns; tsc0 = tsc;}
+		}
+
+		while(pfcClkMonoRaw() - ns0 < CALIB_NANOS){}
+
+		w1 = ~0ULL;
+		for(j=0;j<8;j++){
+			w = pfcClkSample(&ns, &tsc);
+			if(w < w1){w1 = w; ns1 = ns; tsc1 = tsc;}
+		}
+
+		if(w0+w1 < best && ns1 > ns0){
+			best = w0+w1;
+			hz   = (tsc1-tsc0) * 1e9 / (ns1-ns0);
+		}
+	}
+
+	return hz;
+}
+
+/**
+ * Crystal clock frequency for Intel models that report CPUID.15H.ECX == 0.
+ *
+ * See "Table 18-85. Nominal Core Crystal Clock Frequency" in the Intel SDM
+ * Vol 3.
+ */
+
+static double   pfcClkCrystalHz  (unsigned dispModel){
+	switch(dispModel){
+		case 0x4E: case 0x5E:             /* Skylake client */
+		case 0x8E: case 0x9E:             /* Kaby/Coffee Lake client */
+		return 24000000.0;
+		case 0x55:                        /* Skylake-SP */
+		return 25000000.0;
+		case 0x5C:                        /* Goldmont */
+		return 19200000.0;
+		default:
+		return 0;
+	}
+}
+
+/**
+ * Determine all clock domains. Called exactly once through pthread_once().
+ */
+
+static void     pfcClkInitOnce   (void){
+	unsigned a, b, c, d, maxLeaf, family, dispModel, ratio;
+	char     vendor[13];
+	uint64_t platInfo = 0;
+	double   tscRatio = 0, busHz = 0;
+
+	memset(&clk, 0, sizeof(clk));
+
+
+	/* Identify processor. */
+	__cpuid(0, maxLeaf, b, c, d);
+	memcpy(vendor+0, &b, 4);
+	memcpy(vendor+4, &d, 4);
+	memcpy(vendor+8, &c, 4);
+	vendor[12] = '\0';
+	__cpuid(1, a, b, c, d);
+	family    = (a >>  8) & 0x0F;
+	dispModel = (a >>  4) & 0x0F;
+	if(family == 0x06 || family == 0x0F){
+		dispModel |= ((a >> 16) & 0x0F) << 4;
+	}
+
+
+	/**
+	 * CPUID.15H: TSC/"core crystal clock" ratio EBX/EAX, and crystal clock
+	 * frequency in ECX (if enumerated).
+	 */
+
+	if(maxLeaf >= 0x15){
+		__cpuid_count(0x15, 0, a, b, c, d);
+		if(a && b){
+			tscRatio      = (double)b / a;
+			clk.crystalHz = c;
+			if(!clk.crystalHz && strcmp(vendor, "GenuineIntel") == 0){
+				clk.crystalHz = pfcClkCrystalHz(dispModel);
+			}
+			if(clk.crystalHz){
+				clk.tscHz  = clk.crystalHz * tscRatio;
+				clk.tscSrc = PFC_CLK_SRC_CPUID15;
+			}
+		}
+	}
+
+
+	/**
+	 * CPUID.16H: Base, maximum and bus (reference) frequencies, in MHz.
+	 */
+
+	if(maxLeaf >= 0x16){
+		__cpuid_count(0x16, 0, a, b, c, d);
+		clk.nominalHz = (a & 0xFFFF) * 1e6;
+		busHz         = (c & 0xFFFF) * 1e6;
+		if(!clk.tscHz && clk.nominalHz){
+			clk.tscHz  = clk.nominalHz;
+			clk.tscSrc = PFC_CLK_SRC_CPUID16;
+		}
+		if(!clk.crystalHz && tscRatio && clk.nominalHz){
+			clk.crystalHz = clk.nominalHz / tscRatio;
+		}
+	}
+
+
+	/**
+	 * MSR_PLATFORM_INFO[15:8]: Maximum non-turbo ratio, in units of the bus
+	 * clock. The bus clock is 100MHz from Sandy Bridge onwards, which is every
+	 * processor pfc.ko supports (ArchPerfMon v3+) except Nehalem/Westmere's
+	 * 133.33MHz.
+	 */
+
+	if(pfcRdMSR(MSR_PLATFORM_INFO, &platInfo) == sizeof(platInfo)){
+		ratio = (platInfo >> 8) & 0xFF;
+		if(!busHz){
+			switch(dispModel){
+				case 0x1A: case 0x1E: case 0x1F: case 0x2E:    /* Nehalem  */
+				case 0x25: case 0x2C: case 0x2F:               /* Westmere */
+				busHz = 133333333.3;
+				break;
+				default:
+				busHz = 100000000.0;
+				break;
+			}
+		}
+		if(ratio){
+			clk.nominalHz = ratio * busHz;
+			if(!clk.tscHz){
+				clk.tscHz  = clk.nominalHz;
+				clk.tscSrc = PFC_CLK_SRC_PLATINFO;
+			}
+		}
+	}
+
+
+	/**
+	 * Calibrate against CLOCK_MONOTONIC_RAW, and use it if nothing else was
+	 * available or the CPUID/MSR-derived value is implausible.
+	 */
+
+	clk.measuredHz = pfcClkMeasure();
+	if(!clk.tscHz ||
+	   (clk.measuredHz && (clk.tscHz > clk.measuredHz*(1+CALIB_TOLERANCE) ||
+	                       clk.tscHz < clk.measuredHz*(1-CALIB_TOLERANCE)))){
+		clk.tscHz  = clk.measuredHz;
+		clk.tscSrc = clk.tscHz ? PFC_CLK_SRC_MEASURED : PFC_CLK_SRC_NONE;
+	}
+	if(!clk.nominalHz){
+		clk.nominalHz = clk.tscHz;
+	}
+
+
+	/**
+	 * REF_XCLK ticks at the crystal clock on parts that enumerate CPUID.15H,
+	 * and at the bus clock on older ones.
+	 */
+
+	clk.xclkHz = clk.crystalHz ? clk.crystalHz :
+	             busHz         ? busHz         : 100000000.0;
+
+
+	/* Precompute conversion factors. */
+	nsPerTsc  = clk.tscHz     ? 1e9/clk.tscHz     : 0;
+	nsPerCyc  = clk.nominalHz ? 1e9/clk.nominalHz : 0;
+	nsPerXclk = clk.xclkHz    ? 1e9/clk.xclkHz    : 0;
+}
+
+
+/* Function Definitions */
+
+const PFC_CLK* pfcClkInit     (void){
+	pthread_once(&clkOnce, pfcClkInitOnce);
+	return &clk;
+}
+
+double    pfcTscToNs       (int64_t tsc){
+	pfcClkInit();
+	return tsc*nsPerTsc;
+}
+
+double    pfcRefToNs       (int64_t ref){
+	pfcClkInit();
+	return ref*nsPerTsc;
+}
+
+double    pfcCycToNs       (int64_t cyc){
+	pfcClkInit();
+	return cyc*nsPerCyc;
+}
+
+double    pfcXclkToNs      (int64_t xclk){
+	pfcClkInit();
+	return xclk*nsPerXclk;
+}
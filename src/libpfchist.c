@@ -0,0 +1,218 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Defines */
+#define SUB                     PFC_HIST_SUB_BITS
+
+/**
+ * Single-writer counter updates. Only the owning thread ever writes a
+ * per-thread histogram, so an increment need not be atomic as a whole; The
+ * relaxed load and store only keep the reporter's concurrent reads
+ * well-defined, and compile to plain movs on x86.
+ */
+
+#define HIST_LD(p)              __atomic_load_n ((p),      __ATOMIC_RELAXED)
+#define HIST_ST(p, v)           __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define HIST_ADD(p, v)          HIST_ST((p), HIST_LD(p) + (v))
+
+
+/* Data Structures */
+struct HISTTLS;
+typedef struct HISTTLS HISTTLS;
+
+/**
+ * One thread's histograms, one per endpoint it has recorded into.
+ */
+
+struct HISTTLS{
+	HISTTLS*  next;
+	PFC_HIST* ep[PFC_HIST_ENDPOINTS];
+};
+
+
+/* Global data */
+static pthread_mutex_t  histLock = PTHREAD_MUTEX_INITIALIZER;
+static HISTTLS*         histList = NULL;
+static PFC_HIST*        histDead[PFC_HIST_ENDPOINTS];/* Records of exited threads */
+static pthread_once_t   histOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t    histKey;
+static __thread HISTTLS* histSelf = NULL;
+
+
+
+/* Static Function Definitions */
+
+/**
+ * Bucket of value v, and lowest value of bucket b.
+ */
+
+static inline int      pfcHistBucket    (PFC_CNT c){
+	uint64_t v = c < 0 ? 0 : (uint64_t)c;
+	int      e;
+
+	if(v < (1u << SUB)){
+		return (int)v;
+	}
+	e = 63 - __builtin_clzll(v);
+	return ((e-SUB+1) << SUB) + (int)((v >> (e-SUB)) & ((1u << SUB)-1));
+}
+static double          pfcHistBucketLo  (int b){
+	if(b < (1 << SUB)){
+		return b;
+	}
+	return ldexp(((1 << SUB) + (b & ((1 << SUB)-1))), (b >> SUB) - 1);
+}
+
+/**
+ * Add histogram src into dst.
+ */
+
+static void            pfcHistMerge     (PFC_HIST* dst, const PFC_HIST* src){
+	int k, b;
+
+	dst->n += HIST_LD(&src->n);
+	for(k=0;k<7;k++){
+		dst->sum[k] += HIST_LD(&src->sum[k]);
+		for(b=0;b<PFC_HIST_BUCKETS;b++){
+			dst->bkt[k][b] += HIST_LD(&src->bkt[k][b]);
+		}
+	}
+}
+
+/**
+ * Destructor of a registered thread: Unregister it, and fold its histograms
+ * into those of the exited threads, adopting the first of every endpoint
+ * outright and freeing the rest.
+ */
+
+static void            pfcHistExit      (void* arg){
+	HISTTLS*  t = arg, **pp;
+	int       e;
+
+	pthread_mutex_lock(&histLock);
+	for(pp=&histList;*pp && *pp != t;pp=&(*pp)->next){}
+	if(*pp){
+		*pp = t->next;
+	}
+	for(e=0;e<PFC_HIST_ENDPOINTS;e++){
+		if(!t->ep[e]){
+			continue;
+		}
+		if(!histDead[e]){
+			histDead[e] = t->ep[e];
+		}else{
+			pfcHistMerge(histDead[e], t->ep[e]);
+			free(t->ep[e]);
+		}
+	}
+	pthread_mutex_unlock(&histLock);
+
+	histSelf = NULL;
+	free(t);
+}
+static void            pfcHistKeyInit   (void){
+	pthread_key_create(&histKey, pfcHistExit);
+}
+
+/**
+ * Slow path of pfcHistRecord(): Allocate the calling thread's histogram for
+ * endpoint, registering the thread first if need be.
+ */
+
+static PFC_HIST*       pfcHistAlloc     (int endpoint){
+	PFC_HIST* h;
+
+	if(!histSelf){
+		if(!(histSelf = calloc(1, sizeof(*histSelf)))){
+			return NULL;
+		}
+		pthread_once(&histOnce, pfcHistKeyInit);
+		pthread_setspecific(histKey, histSelf);
+		pthread_mutex_lock(&histLock);
+		histSelf->next = histList;
+		histList       = histSelf;
+		pthread_mutex_unlock(&histLock);
+	}
+	if(!(h = calloc(1, sizeof(*h)))){
+		return NULL;
+	}
+	__atomic_store_n(&histSelf->ep[endpoint], h, __ATOMIC_RELEASE);
+	return h;
+}
+
+
+/* Function Definitions */
+
+int       pfcHistRecord    (int endpoint, const PFC_CNT* cnts){
+	PFC_HIST* h;
+	int       k;
+
+	if(endpoint < 0 || endpoint >= PFC_HIST_ENDPOINTS){
+		return -1;
+	}
+	h = histSelf ? histSelf->ep[endpoint] : NULL;
+	if(__builtin_expect(!h, 0) && !(h = pfcHistAlloc(endpoint))){
+		return -1;
+	}
+
+	HIST_ADD(&h->n, 1);
+	for(k=0;k<7;k++){
+		HIST_ADD(&h->sum[k], cnts[k]);
+		HIST_ADD(&h->bkt[k][pfcHistBucket(cnts[k])], 1);
+	}
+	return 0;
+}
+
+int       pfcHistSnapshot  (int endpoint, PFC_HIST* h){
+	const HISTTLS*  t;
+	const PFC_HIST* src;
+
+	if(endpoint < 0 || endpoint >= PFC_HIST_ENDPOINTS){
+		return -1;
+	}
+
+	memset(h, 0, sizeof(*h));
+	pthread_mutex_lock(&histLock);
+	for(t=histList;t;t=t->next){
+		src = __atomic_load_n(&t->ep[endpoint], __ATOMIC_ACQUIRE);
+		if(src){
+			pfcHistMerge(h, src);
+		}
+	}
+	if(histDead[endpoint]){
+		pfcHistMerge(h, histDead[endpoint]);
+	}
+	pthread_mutex_unlock(&histLock);
+	return 0;
+}
+
+double    pfcHistQuantile  (const PFC_HIST* h, int k, double q){
+	uint64_t total = 0, acc = 0, want;
+	int      b;
+
+	for(b=0;b<PFC_HIST_BUCKETS;b++){
+		total += h->bkt[k][b];
+	}
+	if(!total){
+		return 0;
+	}
+
+	q    = q < 0 ? 0 : q > 1 ? 1 : q;
+	want = (uint64_t)(q*(total-1)) + 1;
+	for(b=0;b<PFC_HIST_BUCKETS;b++){
+		acc += h->bkt[k][b];
+		if(acc >= want){
+			break;
+		}
+	}
+	b = b < PFC_HIST_BUCKETS ? b : PFC_HIST_BUCKETS-1;
+	return (pfcHistBucketLo(b) + (b+1 < PFC_HIST_BUCKETS ? pfcHistBucketLo(b+1) : ldexp(1, 64)) - 1) / 2;
+}
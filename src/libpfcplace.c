@@ -0,0 +1,326 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <dirent.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/* Defines */
+#define MAXCPU                  4096
+#define SYSCPU                  "/sys/devices/system/cpu"
+
+/**
+ * A sibling counts as idle below this busy fraction. Housekeeping ticks keep
+ * even an idle CPU slightly above 0.
+ */
+
+#define IDLE_BUSY               0.02
+
+/* /proc/stat sampling window, in ns. */
+#define SAMPLE_NS               100000000L
+
+
+/* Data Structures */
+struct CPUINFO;
+typedef struct CPUINFO CPUINFO;
+
+struct CPUINFO{
+	unsigned char online, allowed, isolated;
+	uint64_t      idle, total;
+	double        busy;
+};
+
+
+/* Static Function Definitions */
+
+/**
+ * Parse a sysfs CPU list such as "0-3,8,10-11" from file path into set.
+ * Returns the number of CPUs listed, or -1 if the file could not be read.
+ */
+
+static int             pfcPlaceRdList   (const char* path, unsigned char* set){
+	char  buf[8192], *s = buf, *e;
+	FILE* f = fopen(path, "r");
+	long  lo, hi;
+	int   n = 0;
+
+	memset(set, 0, MAXCPU);
+	if(!f){
+		return -1;
+	}
+	if(!fgets(buf, sizeof(buf), f)){
+		buf[0] = '\0';
+	}
+	fclose(f);
+
+	while(*s >= '0' && *s <= '9'){
+		lo = hi = strtol(s, &e, 10);
+		if(*e == '-'){
+			hi = strtol(e+1, &e, 10);
+		}
+		for(;lo<=hi && lo<MAXCPU;lo++,n++){
+			set[lo] = 1;
+		}
+		s = *e == ',' ? e+1 : e;
+	}
+	return n;
+}
+
+static int             pfcPlaceRdInt    (const char* path, int dflt){
+	FILE* f = fopen(path, "r");
+	int   v;
+
+	if(!f){
+		return dflt;
+	}
+	if(fscanf(f, "%d", &v) != 1){
+		v = dflt;
+	}
+	fclose(f);
+	return v;
+}
+
+/**
+ * Accumulate the idle and total jiffies of every CPU from /proc/stat into
+ * cpus. Called twice, with the first pass' values negated, to get deltas.
+ */
+
+static void            pfcPlaceRdStat   (CPUINFO* cpus, int sign){
+	char               line[512];
+	unsigned long long v[8] = {0};
+	uint64_t           t;
+	FILE*              f = fopen("/proc/stat", "r");
+	int                c, i;
+
+	if(!f){
+		return;
+	}
+	while(fgets(line, sizeof(line), f)){
+		if(sscanf(line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", &c,
+		          &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) != 9 ||
+		   c < 0 || c >= MAXCPU){
+			continue;
+		}
+		for(t=0,i=0;i<8;i++){
+			t += v[i];
+		}
+		cpus[c].idle  += sign*(int64_t)(v[3]+v[4]);
+		cpus[c].total += sign*(int64_t)t;
+	}
+	fclose(f);
+}
+
+/**
+ * Online CPUs other than cpu listed in file name of directory dir.
+ */
+
+static int             pfcPlaceSharers  (const CPUINFO* cpus, const char* dir,
+                                         const char* name, int cpu){
+	unsigned char set[MAXCPU];
+	char          path[256];
+	int           i, n = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if(pfcPlaceRdList(path, set) < 0){
+		return -1;
+	}
+	for(i=0;i<MAXCPU;i++){
+		n += set[i] && cpus[i].online && i != cpu;
+	}
+	return n;
+}
+
+/**
+ * Fill in a candidate's topology.
+ */
+
+static void            pfcPlaceDescribe (const CPUINFO* cpus, int cpu, PFC_PLACEMENT* p){
+	unsigned char  set[MAXCPU];
+	char           dir[128], path[256];
+	DIR*           d;
+	struct dirent* e;
+	int            i, level, idx;
+
+	memset(p, 0, sizeof(*p));
+	p->cpu         = cpu;
+	p->isolated    = cpus[cpu].isolated;
+	p->busy        = cpus[cpu].busy;
+	p->node        = -1;
+	p->l2Sharers   = -1;
+	p->llcSharers  = -1;
+
+	snprintf(dir,  sizeof(dir),  SYSCPU "/cpu%d", cpu);
+	snprintf(path, sizeof(path), "%s/topology/core_id", dir);
+	p->core    = pfcPlaceRdInt(path, cpu);
+	snprintf(path, sizeof(path), "%s/topology/physical_package_id", dir);
+	p->package = pfcPlaceRdInt(path, 0);
+
+	snprintf(path, sizeof(path), "%s/topology/thread_siblings_list", dir);
+	if(pfcPlaceRdList(path, set) >= 0){
+		for(i=0;i<MAXCPU;i++){
+			if(set[i] && i != cpu && cpus[i].online){
+				p->siblings++;
+				p->siblingBusy = cpus[i].busy > p->siblingBusy ?
+				                 cpus[i].busy : p->siblingBusy;
+			}
+		}
+	}
+
+	for(idx=0;;idx++){
+		snprintf(path, sizeof(path), "%s/cache/index%d/level", dir, idx);
+		if((level = pfcPlaceRdInt(path, -1)) < 0){
+			break;
+		}
+		snprintf(path, sizeof(path), "%s/cache/index%d", dir, idx);
+		if(level == 2){
+			p->l2Sharers  = pfcPlaceSharers(cpus, path, "shared_cpu_list", cpu);
+		}else if(level == 3){
+			p->llcSharers = pfcPlaceSharers(cpus, path, "shared_cpu_list", cpu);
+		}
+	}
+
+	if((d = opendir(dir))){
+		while((e = readdir(d))){
+			if(strncmp(e->d_name, "node", 4) == 0 &&
+			   e->d_name[4] >= '0' && e->d_name[4] <= '9'){
+				p->node = atoi(e->d_name+4);
+				break;
+			}
+		}
+		closedir(d);
+	}
+
+	snprintf(p->report, sizeof(p->report),
+	         "cpu %d: core %d, package %d, node %d, %s, busy %.1f%%, "
+	         "%d SMT sibling(s) at most %.1f%% busy, "
+	         "L2 shared with %d, LLC shared with %d other CPU(s)",
+	         p->cpu, p->core, p->package, p->node,
+	         p->isolated ? "isolated" : "not isolated", 100*p->busy,
+	         p->siblings, 100*p->siblingBusy, p->l2Sharers, p->llcSharers);
+}
+
+/**
+ * pfcPlace() proper, on the caller's zeroed table of MAXCPU CPUs.
+ */
+
+static int             pfcPlaceRun      (CPUINFO* cpus, int flags, PFC_PLACEMENT* p){
+	unsigned char   set[MAXCPU];
+	cpu_set_t       aff;
+	struct timespec ts = {0, SAMPLE_NS};
+	PFC_PLACEMENT   cand;
+	double          score, best = 0;
+	int             i, n, found = 0;
+
+	/**
+	 * Gather the online, allowed and isolated CPUs. Without an online file
+	 * (e.g. a container without sysfs), every allowed CPU is taken as online.
+	 */
+
+	CPU_ZERO(&aff);
+	if(sched_getaffinity(0, sizeof(aff), &aff) != 0){
+		return PFC_ERR_AFFINITY_FAILED;
+	}
+	n = pfcPlaceRdList(SYSCPU "/online", set);
+	for(i=0;i<MAXCPU;i++){
+		cpus[i].allowed = i < CPU_SETSIZE && CPU_ISSET(i, &aff);
+		cpus[i].online  = n < 0 ? cpus[i].allowed : set[i];
+	}
+	pfcPlaceRdList(SYSCPU "/isolated",  set);
+	for(i=0;i<MAXCPU;i++){
+		cpus[i].isolated  = set[i];
+	}
+	pfcPlaceRdList(SYSCPU "/nohz_full", set);
+	for(i=0;i<MAXCPU;i++){
+		cpus[i].isolated |= set[i];
+	}
+
+	/* Measure how busy every CPU is. */
+	pfcPlaceRdStat(cpus, -1);
+	nanosleep(&ts, NULL);
+	pfcPlaceRdStat(cpus, +1);
+	for(i=0;i<MAXCPU;i++){
+		cpus[i].busy = cpus[i].total ?
+		               1 - (double)cpus[i].idle/cpus[i].total : 0;
+	}
+
+	/**
+	 * Score each candidate by how busy its physical core is. Isolated CPUs
+	 * always beat non-isolated ones, and CPU 0, which takes most
+	 * housekeeping interrupts, is a last resort.
+	 */
+
+	for(i=0;i<MAXCPU;i++){
+		if(!cpus[i].online || !cpus[i].allowed){
+			continue;
+		}
+		if((flags & PFC_PLACE_ISOLATED) && !cpus[i].isolated){
+			continue;
+		}
+		pfcPlaceDescribe(cpus, i, &cand);
+		if((flags & PFC_PLACE_SIBLING_IDLE) && cand.siblingBusy > IDLE_BUSY){
+			continue;
+		}
+		score = cand.busy + cand.siblingBusy + (cand.isolated ? 0 : 4) + (i == 0 ? 2 : 0);
+		if(!found || score < best){
+			*p    = cand;
+			best  = score;
+			found = 1;
+		}
+	}
+	if(!found){
+		return PFC_ERR_CPU_PIN_FAILED;
+	}
+
+	if(!(flags & PFC_PLACE_NOPIN) && pfcPinThread(p->cpu) != 0){
+		return PFC_ERR_CPU_PIN_FAILED;
+	}
+	return 0;
+}
+
+
+/* Function Definitions */
+
+int       pfcPlace         (int flags, PFC_PLACEMENT* p){
+	CPUINFO* cpus;
+	int      ret;
+
+	memset(p, 0, sizeof(*p));
+	p->cpu = -1;
+
+	/* Per call rather than static, so that threads may place themselves at once. */
+	if(!(cpus = calloc(MAXCPU, sizeof(*cpus)))){
+		return PFC_ERR_CPU_PIN_FAILED;
+	}
+	ret = pfcPlaceRun(cpus, flags, p);
+	free(cpus);
+	return ret;
+}
+
+void*     pfcPlaceAlloc    (size_t size){
+	long  pg = sysconf(_SC_PAGESIZE);
+	char* ptr;
+	size_t i;
+
+	ptr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(ptr == MAP_FAILED){
+		return NULL;
+	}
+	for(i=0;i<size;i+=pg){
+		ptr[i] = 0;
+	}
+	return ptr;
+}
+
+void      pfcPlaceFree     (void* ptr, size_t size){
+	if(ptr){
+		munmap(ptr, size);
+	}
+}
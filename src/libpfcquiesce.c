@@ -0,0 +1,221 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* Defines */
+#define MAXCPU                  4096
+
+#define SAVED_PERF_CTL          0x1
+#define SAVED_MISC_ENABLE       0x2
+#define SAVED_EPB               0x4
+#define SAVED_DEBUGCTL          0x8
+
+
+/* Data Structures */
+struct QSAVED;
+typedef struct QSAVED QSAVED;
+
+/**
+ * Prior state of one quiesced CPU. Only the MSRs flagged in saved were
+ * changed, and only they are written back.
+ */
+
+struct QSAVED{
+	int       cpu;
+	int       saved;
+	uint64_t  perfCtl;
+	uint64_t  miscEnable;
+	uint64_t  epb;
+	uint64_t  debugCtl;
+};
+
+
+/* Global data */
+static QSAVED  qSaved[MAXCPU];
+static int     qN      = 0;
+static int     qFd     = -1;
+static int     qHooked = 0;
+static const int QSIGNALS[] = {SIGHUP, SIGINT, SIGQUIT, SIGILL, SIGABRT,
+                               SIGBUS, SIGFPE, SIGSEGV, SIGTERM};
+
+
+
+/* Static Function Definitions */
+
+static int             pfcQRd           (uint64_t msr, uint64_t* v){
+	return pread (qFd, v, sizeof(*v), msr) == sizeof(*v) ? 0 : -1;
+}
+static int             pfcQWr           (uint64_t msr, uint64_t  v){
+	return pwrite(qFd, &v, sizeof(v), msr) == sizeof(v)  ? 0 : -1;
+}
+
+/**
+ * Restore on a fatal signal, then die of it as we would have. Only system
+ * calls are made, so this is safe enough in a signal handler. Only signals
+ * left at SIG_DFL are hooked: Those the application handles or ignores keep
+ * their disposition, and an application that exits from its own handler
+ * through exit() is restored by atexit().
+ */
+
+static void            pfcQSignal       (int sig){
+	pfcRestore();
+	raise(sig);
+}
+
+static void            pfcQHook         (void){
+	struct sigaction sa, old;
+	size_t           i;
+
+	if(qHooked){
+		return;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = pfcQSignal;
+	sa.sa_flags   = SA_RESETHAND;
+	sigemptyset(&sa.sa_mask);
+	for(i=0;i<sizeof(QSIGNALS)/sizeof(*QSIGNALS);i++){
+		if(sigaction(QSIGNALS[i], NULL, &old) == 0 &&
+		   !(old.sa_flags & SA_SIGINFO) && old.sa_handler == SIG_DFL){
+			sigaction(QSIGNALS[i], &sa, NULL);
+		}
+	}
+	atexit(pfcRestore);
+	qHooked = 1;
+}
+
+/**
+ * Quiesce the calling thread's CPU, recording its prior state into s first.
+ */
+
+static int             pfcQuiesceCpu    (QSAVED* s, int ratio, int flags){
+	uint64_t v;
+
+	if(ratio >= 0){
+		if(pfcQRd(MSR_IA32_PERF_CTL, &s->perfCtl)){
+			return -1;
+		}
+		s->saved |= SAVED_PERF_CTL;
+		v = (s->perfCtl & ~0xFFFFULL) | ((uint64_t)ratio << 8);
+		if(pfcQWr(MSR_IA32_PERF_CTL, v)){
+			return -1;
+		}
+	}
+	if(flags & PFC_QUIESCE_NOTURBO){
+		if(pfcQRd(MSR_IA32_MISC_ENABLE, &s->miscEnable)){
+			return -1;
+		}
+		s->saved |= SAVED_MISC_ENABLE;
+		if(pfcQWr(MSR_IA32_MISC_ENABLE, s->miscEnable | 1ULL<<38)){
+			return -1;
+		}
+	}
+	if(flags & PFC_QUIESCE_EPB){
+		if(pfcQRd(MSR_IA32_ENERGY_PERF_BIAS, &s->epb)){
+			return -1;
+		}
+		s->saved |= SAVED_EPB;
+		if(pfcQWr(MSR_IA32_ENERGY_PERF_BIAS, 0)){
+			return -1;
+		}
+	}
+	if(flags & PFC_QUIESCE_FREEZE_SMM){
+		if(pfcQRd(MSR_IA32_DEBUGCTL, &s->debugCtl)){
+			return -1;
+		}
+		s->saved |= SAVED_DEBUGCTL;
+		if(pfcQWr(MSR_IA32_DEBUGCTL, s->debugCtl | 1ULL<<14)){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+/* Function Definitions */
+
+int       pfcQuiesce       (const int* cpus, int ncpus, int ratio, int flags){
+	cpu_set_t saved;
+	uint64_t  platInfo;
+	int       i, ret = 0;
+
+	if(qN > 0){
+		pfcRestore();
+	}
+	if(ncpus < 0 || ncpus > MAXCPU){
+		return PFC_ERR_CPU_PIN_FAILED;
+	}
+	if(qFd < 0 && (qFd = open("/sys/module/pfc/msr", O_RDWR | O_CLOEXEC)) < 0){
+		return PFC_ERR_OPENING_SYSFILE;
+	}
+
+	/* The nominal ratio is MSR_PLATFORM_INFO[15:8]. */
+	if(ratio == 0){
+		if(pfcQRd(MSR_PLATFORM_INFO, &platInfo)){
+			return PFC_ERR_PWRITE_FAILED;
+		}
+		ratio = (platInfo >> 8) & 0xFF;
+	}
+
+	if(sched_getaffinity(0, sizeof(saved), &saved) == -1){
+		return PFC_ERR_AFFINITY_FAILED;
+	}
+	pfcQHook();
+	for(i=0;i<ncpus && !ret;i++){
+		if(pfcPinThread(cpus[i]) != 0){
+			ret = PFC_ERR_CPU_PIN_FAILED;
+			break;
+		}
+		memset(&qSaved[qN], 0, sizeof(qSaved[qN]));
+		qSaved[qN].cpu = cpus[i];
+		if(pfcQuiesceCpu(&qSaved[qN], ratio, flags) != 0){
+			ret = PFC_ERR_PWRITE_FAILED;
+		}
+		qN++;
+	}
+	sched_setaffinity(0, sizeof(saved), &saved);
+
+	if(ret){
+		pfcRestore();
+	}
+	return ret;
+}
+
+void      pfcRestore       (void){
+	const QSAVED* s;
+	cpu_set_t     saved;
+
+	if(qN <= 0 || qFd < 0){
+		return;
+	}
+
+	/* In reverse, so that a CPU listed twice ends up in its first state. */
+	sched_getaffinity(0, sizeof(saved), &saved);
+	while(qN > 0){
+		s = &qSaved[--qN];
+		if(pfcPinThread(s->cpu) != 0){
+			continue;
+		}
+		if(s->saved & SAVED_DEBUGCTL){
+			pfcQWr(MSR_IA32_DEBUGCTL,         s->debugCtl);
+		}
+		if(s->saved & SAVED_EPB){
+			pfcQWr(MSR_IA32_ENERGY_PERF_BIAS, s->epb);
+		}
+		if(s->saved & SAVED_MISC_ENABLE){
+			pfcQWr(MSR_IA32_MISC_ENABLE,      s->miscEnable);
+		}
+		if(s->saved & SAVED_PERF_CTL){
+			pfcQWr(MSR_IA32_PERF_CTL,         s->perfCtl);
+		}
+	}
+	sched_setaffinity(0, sizeof(saved), &saved);
+}
@@ -0,0 +1,229 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Data Structures */
+struct REGIONCTX;
+typedef struct REGIONCTX REGIONCTX;
+
+/**
+ * One thread's region tree.
+ *
+ *     cur:   Innermost open region, or &root.
+ *     bias:  Counts of a node's own PFCSTART/PFCEND pair.
+ *     cost:  Counts that one empty child adds to its parent.
+ */
+
+struct REGIONCTX{
+	PFC_REGION   root;
+	PFC_REGION*  cur;
+	int          calibrated;
+	uint64_t     msk [7];
+	PFC_CNT      bias[7];
+	PFC_CNT      cost[7];
+};
+
+
+/* Global data */
+static __thread REGIONCTX* regionSelf = NULL;
+
+
+
+/* Static Function Definitions */
+
+static void        pfcRegionFree    (PFC_REGION* r){
+	PFC_REGION* c, *n;
+
+	for(c=r->child;c;c=n){
+		n = c->next;
+		pfcRegionFree(c);
+		free(c);
+	}
+	r->child = NULL;
+}
+
+static void        pfcRegionEnterIn (REGIONCTX* ctx, const char* name){
+	PFC_REGION* p = ctx->cur, *n, *last = NULL;
+
+	for(n=p->child;n;last=n,n=n->next){
+		if(n->name == name || strcmp(n->name, name) == 0){
+			break;
+		}
+	}
+	if(!n){
+		if(!(n = calloc(1, sizeof(*n)))){
+			abort();
+		}
+		n->name   = name;
+		n->parent = p;
+		if(last){
+			last->next = n;
+		}else{
+			p->child   = n;
+		}
+	}
+
+	memset(n->raw,  0, sizeof(n->raw));
+	memset(n->kids, 0, sizeof(n->kids));
+	memset(n->ovh,  0, sizeof(n->ovh));
+	ctx->cur = n;
+	PFCSTART(n->raw);
+}
+
+static void        pfcRegionExitIn  (REGIONCTX* ctx){
+	PFC_REGION* n = ctx->cur, *p = n->parent;
+	PFC_CNT     incl;
+	int         k;
+
+	if(n == &ctx->root){
+		return;
+	}
+	PFCEND(n->raw);
+
+	/**
+	 * Inclusive: Raw delta net of this node's read bias and of the
+	 * instrumentation of all its descendants. Exclusive: Inclusive net of the
+	 * children's inclusive. The parent is charged one child's cost on top of
+	 * everything this node's descendants cost it.
+	 */
+
+	for(k=0;k<7;k++){
+		incl        = (PFC_CNT)(n->raw[k] & ctx->msk[k]) - ctx->bias[k] - n->ovh[k];
+		n->incl[k] += incl;
+		n->excl[k] += incl - n->kids[k];
+		p->kids[k] += incl;
+		p->ovh [k] += ctx->cost[k] + n->ovh[k];
+	}
+	n->calls++;
+	ctx->cur = p;
+}
+
+/**
+ * Measure the bias and child cost on a scratch tree, under the current
+ * counter configuration. The last of several runs is kept, as with
+ * pfcRemoveBias().
+ */
+
+static void        pfcRegionCalibrate(REGIONCTX* ctx){
+	static const char* const P = "parent", * const C = "child";
+	REGIONCTX   cal;
+	PFC_REGION* p;
+	int         i, k;
+
+	memset(&cal, 0, sizeof(cal));
+	cal.cur = &cal.root;
+	pfcRdMasks(0, 7, cal.msk);
+	memcpy(ctx->msk, cal.msk, sizeof(cal.msk));
+
+	for(i=0;i<10;i++){
+		pfcRegionEnterIn(&cal, P);
+		pfcRegionExitIn (&cal);
+	}
+	p = cal.root.child;
+	for(k=0;k<7;k++){
+		ctx->bias[k] = p->raw[k] & cal.msk[k];
+	}
+
+	for(i=0;i<10;i++){
+		pfcRegionEnterIn(&cal, P);
+		pfcRegionEnterIn(&cal, C);
+		pfcRegionExitIn (&cal);
+		pfcRegionExitIn (&cal);
+	}
+	for(k=0;k<7;k++){
+		ctx->cost[k] = (p->raw[k] & cal.msk[k]) - ctx->bias[k];
+	}
+
+	pfcRegionFree(&cal.root);
+	ctx->calibrated = 1;
+}
+
+static REGIONCTX*  pfcRegionCtx     (void){
+	if(!regionSelf){
+		if(!(regionSelf = calloc(1, sizeof(*regionSelf)))){
+			abort();
+		}
+		regionSelf->root.name = "";
+		regionSelf->cur       = &regionSelf->root;
+	}
+	return regionSelf;
+}
+
+static void        pfcRegionPrint   (const PFC_REGION* r, int depth, void* arg){
+	int k;
+
+	(void)arg;
+	if(depth == 0){
+		return;
+	}
+	printf("%*s%-*s %10llu incl", 2*(depth-1), "", 32-2*(depth-1), r->name,
+	       (unsigned long long)r->calls);
+	for(k=0;k<7;k++){
+		printf(" %14lld", (long long)r->incl[k]);
+	}
+	printf("\n%*s excl", 32+10+1, "");
+	for(k=0;k<7;k++){
+		printf(" %14lld", (long long)r->excl[k]);
+	}
+	printf("\n");
+}
+
+static void        pfcRegionWalkIn  (const PFC_REGION* r,
+                                     void (*fn)(const PFC_REGION* r, int depth, void* arg),
+                                     void* arg, int depth){
+	const PFC_REGION* c;
+
+	fn(r, depth, arg);
+	for(c=r->child;c;c=c->next){
+		pfcRegionWalkIn(c, fn, arg, depth+1);
+	}
+}
+
+
+/* Function Definitions */
+
+void              pfcRegionEnter   (const char* name){
+	REGIONCTX* ctx = pfcRegionCtx();
+
+	if(!ctx->calibrated){
+		pfcRegionCalibrate(ctx);
+	}
+	pfcRegionEnterIn(ctx, name);
+}
+
+void              pfcRegionExit    (void){
+	if(regionSelf){
+		pfcRegionExitIn(regionSelf);
+	}
+}
+
+void              pfcRegionReset   (void){
+	REGIONCTX* ctx = pfcRegionCtx();
+
+	pfcRegionFree(&ctx->root);
+	memset(&ctx->root, 0, sizeof(ctx->root));
+	ctx->root.name  = "";
+	ctx->cur        = &ctx->root;
+	ctx->calibrated = 0;
+}
+
+const PFC_REGION* pfcRegionRoot    (void){
+	return &pfcRegionCtx()->root;
+}
+
+void              pfcRegionWalk    (const PFC_REGION* r,
+                                    void (*fn)(const PFC_REGION* r, int depth, void* arg),
+                                    void* arg){
+	pfcRegionWalkIn(r, fn, arg, 0);
+}
+
+void              pfcRegionDump    (void){
+	printf("%-32s %10s\n", "region", "calls");
+	pfcRegionWalk(pfcRegionRoot(), pfcRegionPrint, NULL);
+}
@@ -0,0 +1,118 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+/* Defines */
+#define RING_LD(p)              __atomic_load_n((p), __ATOMIC_RELAXED)
+
+
+
+/* Static Function Definitions */
+
+static int             pfcRingCtl       (const char* s){
+	ssize_t len = strlen(s), actual;
+	int     fd  = open("/sys/module/pfc/ring", O_WRONLY | O_CLOEXEC);
+
+	if(fd < 0){
+		return PFC_ERR_OPENING_SYSFILE;
+	}
+	actual = write(fd, s, len);
+	close(fd);
+	if (actual == -1) {
+	    return PFC_ERR_PWRITE_FAILED;
+	} else if (actual < len) {
+	    return PFC_ERR_PWRITE_TOO_FEW;
+	}
+	return 0;
+}
+
+
+/* Function Definitions */
+
+int       pfcRingStart     (uint64_t periodNs, const char* cpus){
+	char buf[4096];
+
+	if(snprintf(buf, sizeof(buf), "%llu %s\n", (unsigned long long)periodNs,
+	            cpus) >= (int)sizeof(buf)){
+		return PFC_ERR_PWRITE_FAILED;
+	}
+	return pfcRingCtl(buf);
+}
+
+int       pfcRingStop      (void){
+	return pfcRingCtl("0\n");
+}
+
+int       pfcRingOpen      (PFC_RING* r, int cpu){
+	const uint64_t* hdr;
+	uint64_t        head;
+	void*           base;
+	int             fd;
+
+	memset(r, 0, sizeof(*r));
+	if((fd = open("/sys/module/pfc/rings", O_RDONLY | O_CLOEXEC)) < 0){
+		return PFC_ERR_OPENING_SYSFILE;
+	}
+	base = mmap(NULL, PFC_ABI_RING_BYTES, PROT_READ, MAP_SHARED, fd,
+	            (off_t)cpu*PFC_ABI_RING_BYTES);
+	close(fd);
+	if(base == MAP_FAILED){
+		return PFC_ERR_OPENING_SYSFILE;
+	}
+
+	/* Start from the oldest record still in the ring. */
+	hdr     = (const uint64_t*)base;
+	head    = __atomic_load_n(&hdr[PFC_ABI_RING_HEAD], __ATOMIC_ACQUIRE);
+	r->base = hdr;
+	r->cpu  = cpu;
+	r->next = head >= PFC_ABI_RING_NREC ? head-PFC_ABI_RING_NREC+1 : 1;
+	return 0;
+}
+
+int       pfcRingNext      (PFC_RING* r, PFC_RING_REC* rec){
+	const uint64_t* src;
+	uint64_t        head, seq;
+	int             k;
+
+	head = __atomic_load_n(&r->base[PFC_ABI_RING_HEAD], __ATOMIC_ACQUIRE);
+	while(r->next <= head){
+		if(head - r->next >= PFC_ABI_RING_NREC){
+			r->lost += head - PFC_ABI_RING_NREC + 1 - r->next;
+			r->next  = head - PFC_ABI_RING_NREC + 1;
+		}
+
+		src = r->base + PFC_ABI_RING_HDRW +
+		      ((r->next-1) % PFC_ABI_RING_NREC)*PFC_ABI_RING_RECW;
+		seq = __atomic_load_n(&src[PFC_ABI_RING_SEQ], __ATOMIC_ACQUIRE);
+		rec->tsc = RING_LD(&src[PFC_ABI_RING_TSC]);
+		for(k=0;k<7;k++){
+			rec->cnt[k] = RING_LD(&src[PFC_ABI_RING_CNT+k]);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		/* A record overwritten under us is as lost as one overrun. */
+		if(seq == r->next && RING_LD(&src[PFC_ABI_RING_SEQ]) == seq){
+			rec->seq = seq;
+			r->next++;
+			return 1;
+		}
+		r->lost++;
+		r->next++;
+	}
+	return 0;
+}
+
+void      pfcRingClose     (PFC_RING* r){
+	if(r->base){
+		munmap((void*)r->base, PFC_ABI_RING_BYTES);
+	}
+	memset(r, 0, sizeof(*r));
+}
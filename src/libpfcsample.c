@@ -0,0 +1,112 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <stdint.h>
+#include <string.h>
+#include <x86intrin.h>
+
+
+/* Defines */
+#define SAMPLER_PERIOD_INIT              16
+#define SAMPLER_PERIOD_MIN                1
+#define SAMPLER_PERIOD_MAX         (1u<<24)
+
+
+
+/* Static Function Definitions */
+
+/**
+ * xorshift64 step.
+ */
+
+static uint64_t pfcSamplerRand   (PFC_SAMPLER* s){
+	s->rng ^= s->rng << 13;
+	s->rng ^= s->rng >>  7;
+	s->rng ^= s->rng << 17;
+	return s->rng;
+}
+
+/**
+ * Draw the gap to the next sample, uniform in [1, 2N-1] so its mean is N.
+ */
+
+static void     pfcSamplerDraw   (PFC_SAMPLER* s){
+	uint32_t gap = 1 + pfcSamplerRand(s) % (2*(uint64_t)s->period - 1);
+	s->countdown = gap;
+	s->drawn    += gap;
+}
+
+
+/* Function Definitions */
+
+void      pfcSamplerInit    (PFC_SAMPLER* s, double budget){
+	int i, k;
+
+	memset(s, 0, sizeof(*s));
+	s->period    = SAMPLER_PERIOD_INIT;
+	s->minPeriod = SAMPLER_PERIOD_MIN;
+	s->maxPeriod = SAMPLER_PERIOD_MAX;
+	s->budget    = budget;
+	s->rng       = __rdtsc() ^ (uintptr_t)s;
+	s->rng       = s->rng ? s->rng : 1;
+
+	/**
+	 * Measure the bias of a PFCSTART/PFCEND pair under the current counter
+	 * configuration, as pfcRemoveBias() does.
+	 */
+
+	pfcRdMasks(0, 7, s->msk);
+	for(i=0;i<10;i++){
+		memset(s->bias, 0, sizeof(s->bias));
+		PFCSTART(s->bias);
+		PFCEND  (s->bias);
+	}
+	for(k=0;k<7;k++){
+		s->bias[k] &= s->msk[k];
+	}
+
+	pfcSamplerDraw(s);
+}
+
+void      pfcSamplerUpdate  (PFC_SAMPLER* s){
+	int      k;
+	double   meanCyc, costCyc, want;
+
+	/* Accumulate the sample, net of bias, and rearm the buffer. */
+	for(k=0;k<7;k++){
+		s->sum[k] += (PFC_CNT)(s->tmp[k] & s->msk[k]) - s->bias[k];
+		s->tmp[k]  = 0;
+	}
+	s->samples++;
+	s->active = 0;
+
+	/**
+	 * Retune N. A sample costs about two PFCSTART/PFCEND bodies, while the
+	 * bias only covers the one between the two reads of each counter; Hence
+	 * the factor of 2. The overhead relative to the region cycles is then
+	 * costCyc/(N*meanCyc), which must stay under budget.
+	 */
+
+	meanCyc = (double)s->sum[1] / s->samples;
+	costCyc = 2.0*s->bias[1];
+	if(meanCyc > 0 && costCyc > 0 && s->budget > 0){
+		want      = costCyc / (s->budget * meanCyc);
+		want      = want < s->minPeriod ? s->minPeriod :
+		            want > s->maxPeriod ? s->maxPeriod : want + 1;
+		s->period = (uint32_t)want;
+		s->overhead = costCyc * s->samples / (meanCyc * (s->drawn - s->countdown));
+	}
+
+	pfcSamplerDraw(s);
+}
+
+uint64_t  pfcSamplerEstimate(const PFC_SAMPLER* s, double* est){
+	uint64_t regions = s->drawn - s->countdown;
+	int      k;
+
+	for(k=0;k<7;k++){
+		est[k] = s->samples ? (double)s->sum[k] * regions / s->samples : 0;
+	}
+	return regions;
+}
@@ -0,0 +1,153 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* Defines */
+#define SHM_LD(p)               __atomic_load_n ((p),      __ATOMIC_RELAXED)
+#define SHM_ST(p, v)            __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define SHM_SIZE(n)             (sizeof(PFC_SHM) + (size_t)(n)*sizeof(PFC_SHM_CPU))
+
+/* Attempts at a snapshot before giving up on a writer that died mid-update. */
+#define SHM_TRIES               1000000
+
+
+
+/* Function Definitions */
+
+PFC_SHM*  pfcShmCreate     (const char* path, int ncpus, uint64_t periodNs, const PFC_CFG* cfg){
+	char     tmp[PATH_MAX];
+	PFC_SHM* m;
+	int      fd;
+
+	if(ncpus <= 0){
+		return NULL;
+	}
+	path = path ? path : PFC_SHM_PATH;
+
+
+	/**
+	 * Build the export in a new file and rename it over the old one, rather
+	 * than truncate a file readers may still have mapped: They would fault
+	 * on the pages cut off. Readers of the old export keep its last counts.
+	 */
+
+	if(snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp) ||
+	   (fd = mkostemp(tmp, O_CLOEXEC)) < 0){
+		return NULL;
+	}
+	if(fchmod(fd, 0644) != 0 || ftruncate(fd, SHM_SIZE(ncpus)) != 0){
+		close(fd);
+		unlink(tmp);
+		return NULL;
+	}
+	m = mmap(NULL, SHM_SIZE(ncpus), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(m == MAP_FAILED){
+		unlink(tmp);
+		return NULL;
+	}
+
+	/* Readers check the magic last. */
+	m->ncpus    = ncpus;
+	m->periodNs = periodNs;
+	memcpy(m->cfg, cfg, sizeof(m->cfg));
+	__atomic_store_n(&m->magic, PFC_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	if(rename(tmp, path) != 0){
+		munmap(m, SHM_SIZE(ncpus));
+		unlink(tmp);
+		return NULL;
+	}
+	return m;
+}
+
+void      pfcShmPublish    (PFC_SHM* m, int cpu, uint64_t tsc, const PFC_CNT* cnt){
+	PFC_SHM_CPU* r = &m->cpu[cpu];
+	uint64_t     seq = r->seq;
+	int          k;
+
+	SHM_ST(&r->seq, seq+1);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	SHM_ST(&r->tsc, tsc);
+	for(k=0;k<7;k++){
+		SHM_ST(&r->cnt[k], cnt[k]);
+	}
+	__atomic_store_n(&r->seq, seq+2, __ATOMIC_RELEASE);
+}
+
+const PFC_SHM* pfcShmOpen  (const char* path){
+	const PFC_SHM* m;
+	struct stat    st;
+	uint64_t       ncpus;
+	int            fd;
+
+	path = path ? path : PFC_SHM_PATH;
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0){
+		return NULL;
+	}
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PFC_SHM)){
+		close(fd);
+		return NULL;
+	}
+	m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(m == MAP_FAILED){
+		return NULL;
+	}
+
+	ncpus = m->ncpus;
+	if(__atomic_load_n(&m->magic, __ATOMIC_ACQUIRE) != PFC_SHM_MAGIC ||
+	   SHM_SIZE(ncpus) != (size_t)st.st_size){
+		munmap((void*)m, st.st_size);
+		return NULL;
+	}
+	return m;
+}
+
+int       pfcShmRead       (const PFC_SHM* m, int cpu, PFC_CNT* cnt, uint64_t* tsc){
+	const PFC_SHM_CPU* r;
+	uint64_t           seq;
+	long               i;
+	int                k;
+
+	if(cpu < 0 || (uint64_t)cpu >= m->ncpus){
+		return -1;
+	}
+	r = &m->cpu[cpu];
+
+	for(i=0;i<SHM_TRIES;i++){
+		seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+		if(seq == 0){
+			return -1;
+		}
+		if(seq & 1){
+			continue;
+		}
+		*tsc = SHM_LD(&r->tsc);
+		for(k=0;k<7;k++){
+			cnt[k] = SHM_LD(&r->cnt[k]);
+		}
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(SHM_LD(&r->seq) == seq){
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void      pfcShmClose      (const PFC_SHM* m){
+	if(m){
+		munmap((void*)m, SHM_SIZE(m->ncpus));
+	}
+}
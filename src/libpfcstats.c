@@ -0,0 +1,142 @@
+/* Includes */
+#include "libpfc.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Static Function Definitions */
+
+/**
+ * Sort doubles ascending.
+ */
+
+static int     pfcStatsCmp      (const void* a, const void* b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Quantile q of n sorted samples, linearly interpolated between ranks.
+ */
+
+static double  pfcStatsQuantile (const double* x, size_t n, double q){
+	double r = q*(n-1);
+	size_t i = (size_t)r;
+	return i+1 < n ? x[i] + (r-i)*(x[i+1]-x[i]) : x[n-1];
+}
+
+
+/* Function Definitions */
+
+int       pfcStats         (const double* x, size_t n, PFC_STATS* s){
+	double* y;
+	double  sum = 0, sum2 = 0;
+	size_t  i;
+
+	memset(s, 0, sizeof(*s));
+	if(n == 0 || !(y = malloc(n*sizeof(*y)))){
+		return -1;
+	}
+	memcpy(y, x, n*sizeof(*y));
+	qsort(y, n, sizeof(*y), pfcStatsCmp);
+
+	for(i=0;i<n;i++){
+		sum  += y[i];
+	}
+	s->mean   = sum/n;
+	for(i=0;i<n;i++){
+		sum2 += (y[i]-s->mean)*(y[i]-s->mean);
+	}
+	s->n      = n;
+	s->stddev = n > 1 ? sqrt(sum2/(n-1)) : 0;
+	s->min    = y[0];
+	s->p50    = pfcStatsQuantile(y, n, 0.50);
+	s->p90    = pfcStatsQuantile(y, n, 0.90);
+	s->p99    = pfcStatsQuantile(y, n, 0.99);
+	s->max    = y[n-1];
+
+	free(y);
+	return 0;
+}
+
+int       pfcStatsValid    (const double* x, const int* tags, size_t n, PFC_STATS* s){
+	double* y;
+	size_t  i, m = 0;
+	int     ret;
+
+	if(n == 0 || !(y = malloc(n*sizeof(*y)))){
+		memset(s, 0, sizeof(*s));
+		return -1;
+	}
+	for(i=0;i<n;i++){
+		if(tags[i] == PFC_VALID_CLEAN){
+			y[m++] = x[i];
+		}
+	}
+	ret        = pfcStats(y, m, s);
+	s->dropped = n-m;
+	free(y);
+	return ret;
+}
+
+int       pfcMeasure       (const char* const* evts, void (*fn)(void*), void* arg,
+                            int reps, double units, double* out){
+	static const PFC_CNT ZERO_CNT[7] = {0,0,0,0,0,0,0};
+	PFC_CFG   cfg[7] = {2,2,2,0,0,0,0}, got[7];
+	PFC_CNT   cnt[7];
+	PFC_STATS s;
+	double    vals[7][PFC_MEASURE_MAXREPS];
+	int       r, i, ret;
+
+	reps = reps < 1 ? 1 : reps > PFC_MEASURE_MAXREPS ? PFC_MEASURE_MAXREPS : reps;
+
+
+	/**
+	 * Program and check the configuration: pfc.ko silently disables events
+	 * that the counter or model cannot take, which would read as 0.
+	 */
+
+	for(i=0;i<4 && evts;i++){
+		if(evts[i] && evts[i][0] && !(cfg[3+i] = pfcParseCfg(evts[i]))){
+			return PFC_ERR_UNKNOWN_EVENT;
+		}
+	}
+	if((ret = pfcWrCfgs(0, 7, cfg)) != 0){
+		return ret;
+	}
+	if(pfcRdCfgs(0, 7, got) != sizeof(got)){
+		return PFC_ERR_CFG_REJECTED;
+	}
+	for(i=3;i<7;i++){
+		if(cfg[i] && !got[i]){
+			return PFC_ERR_CFG_REJECTED;
+		}
+	}
+	pfcWrCnts(0, 7, ZERO_CNT);
+	fn(arg);
+
+
+	/**
+	 * Measure.
+	 */
+
+	for(r=0;r<reps;r++){
+		memset(cnt, 0, sizeof(cnt));
+
+		PFCSTART(cnt);
+		fn(arg);
+		PFCEND  (cnt);
+
+		pfcRemoveBias(cnt, 1);
+		for(i=0;i<7;i++){
+			vals[i][r] = (double)cnt[i] / units;
+		}
+	}
+	for(i=0;i<7;i++){
+		pfcStats(vals[i], reps, &s);
+		out[i] = s.p50;
+	}
+	return 0;
+}
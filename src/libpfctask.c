@@ -0,0 +1,40 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <stdint.h>
+#include <string.h>
+
+
+
+/* Function Definitions */
+
+void      pfcTaskInit       (PFC_TASK* t){
+	memset(t, 0, sizeof(*t));
+	pfcRdMasks(0, 7, t->msk);
+}
+
+void      pfcTaskAccount    (PFC_TASK* t, uint32_t cpu){
+	uint64_t sig;
+	int      k, ok = 1;
+
+	if(cpu != t->cpu){
+		t->migrated++;
+		ok = 0;
+	}else{
+		sig    = pfcCfgSignature(cpu);
+		t->sig = t->sig ? t->sig : sig;
+		if(!sig || sig != t->sig){
+			t->mismatched++;
+			ok = 0;
+		}
+	}
+
+	for(k=0;k<7;k++){
+		if(ok){
+			t->cnt[k] += t->tmp[k] & t->msk[k];
+		}
+		t->tmp[k] = 0;
+	}
+	t->intervals += ok;
+}
@@ -0,0 +1,60 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <stdint.h>
+#include <string.h>
+
+
+/* Defines */
+
+/**
+ * MSR_CORE_PERF_LIMIT_REASONS bits 31:16 log the reasons seen since the last
+ * read, which pfc.ko clears. Bits 15:0 are the current status.
+ */
+
+#define LIMIT_LOG_BITS          0xFFFF0000ULL
+
+
+
+/* Function Definitions */
+
+int       pfcValidInit      (PFC_VALID* v, int k, int flags){
+	PFC_CFG cfg = pfcParseCfg("*cpl_cycles.ring0>=1:uk");
+	int     ret;
+
+	memset(v, 0, sizeof(*v));
+	if(k < 3 || k > 6){
+		return PFC_ERR_PWRITE_FAILED;
+	}
+	if((ret = pfcWrCfgs(k, 1, &cfg)) != 0){
+		return ret;
+	}
+	v->k        = k;
+	v->throttle = (flags & PFC_VALID_THROTTLED) &&
+	              pfcRdMSR(MSR_CORE_PERF_LIMIT_REASONS, &v->reasons) == sizeof(v->reasons);
+	return 0;
+}
+
+int       pfcValidEnd       (PFC_VALID* v, const PFC_CNT* cnt){
+	uint32_t cpu = pfcRdCpu();
+	int      tag = PFC_VALID_CLEAN;
+
+	if(cnt[v->k] > 0){
+		tag |= PFC_VALID_PREEMPTED;
+	}
+	if(cpu != v->cpu){
+		tag |= PFC_VALID_MIGRATED;
+	}
+	if(v->throttle &&
+	   pfcRdMSR(MSR_CORE_PERF_LIMIT_REASONS, &v->reasons) == sizeof(v->reasons) &&
+	   (v->reasons & LIMIT_LOG_BITS)){
+		tag |= PFC_VALID_THROTTLED;
+	}
+
+	v->n[0] += tag == PFC_VALID_CLEAN;
+	v->n[1] += !!(tag & PFC_VALID_PREEMPTED);
+	v->n[2] += !!(tag & PFC_VALID_MIGRATED);
+	v->n[3] += !!(tag & PFC_VALID_THROTTLED);
+	return tag;
+}
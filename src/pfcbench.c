@@ -0,0 +1,622 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <cpuid.h>
+#include <ctype.h>
+#include <math.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* Defines */
+
+/**
+ * Exit code understood by Meson as "skipped", used when pfc.ko is absent.
+ */
+
+#define EXIT_SKIP                         77
+
+/**
+ * Maximum number of repetitions of a kernel, and length of JSON lines.
+ */
+
+#define MAXREPS                           64
+#define MAXLINE                         4096
+
+
+/* Data Structures */
+struct KERNEL;
+typedef struct KERNEL KERNEL;
+
+struct KERNEL{
+	const char*   name;
+	const char*   desc;
+	uint64_t      iters;
+	int         (*avail)(void);
+	void        (*setup)(void);
+	void        (*run)  (uint64_t n);
+};
+
+
+/* Global data */
+
+/**
+ * Counter configuration shared by every kernel: The three fixed counters,
+ * followed by four general-purpose events.
+ */
+
+static const char* const CNTNAMES[7] = {
+	"instructions",
+	"cycles",
+	"ref_cycles",
+	"uops_issued.any",
+	"uops_retired.all",
+	"br_misp_retired.all_branches",
+	"mem_load_uops_retired.l1_miss"
+};
+
+static void*         chaseRing[64*8] __attribute__((aligned(4096)));
+static uint8_t       brData[4096];
+static float         saxpyX[1024], saxpyY[1024];
+
+
+/* Kernels */
+
+/**
+ * Four independent add chains: ALU throughput.
+ */
+
+static void kAluTput(uint64_t n){
+	asm volatile(
+	"0:\n\t"
+	"add             $1, %%r8\n\t"
+	"add             $1, %%r9\n\t"
+	"add             $1, %%r10\n\t"
+	"add             $1, %%r11\n\t"
+	"dec             %0\n\t"
+	"jnz             0b\n\t"
+	: "+r"(n)
+	:
+	: "r8", "r9", "r10", "r11", "cc"
+	);
+}
+
+/**
+ * One dependent add chain: ALU latency.
+ */
+
+static void kAluLat(uint64_t n){
+	asm volatile(
+	"0:\n\t"
+	"add             $1, %%r8\n\t"
+	"add             $1, %%r8\n\t"
+	"add             $1, %%r8\n\t"
+	"add             $1, %%r8\n\t"
+	"dec             %0\n\t"
+	"jnz             0b\n\t"
+	: "+r"(n)
+	:
+	: "r8", "cc"
+	);
+}
+
+/**
+ * pfcdemo's FMA+VPADDD mix: 10 independent FMAs and 5 independent VPADDDs.
+ */
+
+static void kFmaTput(uint64_t n){
+	asm volatile(
+	"vzeroall\n\t"
+	"0:\n\t"
+	"vfmadd231ps     %%ymm0,  %%ymm15, %%ymm0\n\t"
+	"vfmadd231ps     %%ymm1,  %%ymm15, %%ymm1\n\t"
+	"vfmadd231ps     %%ymm2,  %%ymm15, %%ymm2\n\t"
+	"vpaddd          %%ymm10, %%ymm15, %%ymm10\n\t"
+	"vfmadd231ps     %%ymm3,  %%ymm15, %%ymm3\n\t"
+	"vfmadd231ps     %%ymm4,  %%ymm15, %%ymm4\n\t"
+	"vfmadd231ps     %%ymm5,  %%ymm15, %%ymm5\n\t"
+	"vpaddd          %%ymm11, %%ymm15, %%ymm11\n\t"
+	"vfmadd231ps     %%ymm6,  %%ymm15, %%ymm6\n\t"
+	"vfmadd231ps     %%ymm7,  %%ymm15, %%ymm7\n\t"
+	"vpaddd          %%ymm12, %%ymm15, %%ymm12\n\t"
+	"vpaddd          %%ymm13, %%ymm15, %%ymm13\n\t"
+	"vfmadd231ps     %%ymm8,  %%ymm15, %%ymm8\n\t"
+	"vfmadd231ps     %%ymm9,  %%ymm15, %%ymm9\n\t"
+	"vpaddd          %%ymm14, %%ymm15, %%ymm14\n\t"
+	"dec             %0\n\t"
+	"jnz             0b\n\t"
+	"vzeroupper\n\t"
+	: "+r"(n)
+	:
+	: "xmm0",  "xmm1",  "xmm2",  "xmm3",  "xmm4",  "xmm5",  "xmm6",  "xmm7",
+	  "xmm8",  "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15",
+	  "cc"
+	);
+}
+
+/**
+ * One dependent FMA chain: FMA latency.
+ */
+
+static void kFmaLat(uint64_t n){
+	asm volatile(
+	"vzeroall\n\t"
+	"0:\n\t"
+	"vfmadd231ps     %%ymm0,  %%ymm15, %%ymm0\n\t"
+	"vfmadd231ps     %%ymm0,  %%ymm15, %%ymm0\n\t"
+	"vfmadd231ps     %%ymm0,  %%ymm15, %%ymm0\n\t"
+	"vfmadd231ps     %%ymm0,  %%ymm15, %%ymm0\n\t"
+	"dec             %0\n\t"
+	"jnz             0b\n\t"
+	"vzeroupper\n\t"
+	: "+r"(n)
+	:
+	: "xmm0", "xmm15", "cc"
+	);
+}
+
+/**
+ * Pointer-chase around a randomly-permuted ring of 64 L1-resident cache lines:
+ * Load-to-use latency.
+ */
+
+static void kLoadLatSetup(void){
+	int i, j, t, perm[64];
+
+	for(i=0;i<64;i++){
+		perm[i] = i;
+	}
+	srand(1);
+	for(i=63;i>0;i--){
+		j = rand() % (i+1);
+		t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+	}
+	for(i=0;i<64;i++){
+		chaseRing[8*perm[i]] = &chaseRing[8*perm[(i+1)%64]];
+	}
+}
+static void kLoadLat(uint64_t n){
+	void* p = chaseRing[0] ? chaseRing[0] : (void*)chaseRing;
+	asm volatile(
+	"0:\n\t"
+	"mov             (%1), %1\n\t"
+	"mov             (%1), %1\n\t"
+	"mov             (%1), %1\n\t"
+	"mov             (%1), %1\n\t"
+	"dec             %0\n\t"
+	"jnz             0b\n\t"
+	: "+r"(n), "+r"(p)
+	:
+	: "memory", "cc"
+	);
+}
+
+/**
+ * Store followed by a dependent reload of the same address: Store-forwarding
+ * latency.
+ */
+
+static void kStoreFwd(uint64_t n){
+	uint64_t slot[8] __attribute__((aligned(64))) = {0};
+	asm volatile(
+	"xor             %%eax, %%eax\n\t"
+	"0:\n\t"
+	"mov             %%rax, (%1)\n\t"
+	"mov             (%1), %%rax\n\t"
+	"mov             %%rax, (%1)\n\t"
+	"mov             (%1), %%rax\n\t"
+	"dec             %0\n\t"
+	"jnz             0b\n\t"
+	: "+r"(n)
+	: "r"(slot)
+	: "rax", "memory", "cc"
+	);
+}
+
+/**
+ * A conditional branch on uniformly-random data: Branch misprediction.
+ */
+
+static void kBranchSetup(void){
+	int i;
+	srand(2);
+	for(i=0;i<(int)sizeof(brData);i++){
+		brData[i] = rand() & 1;
+	}
+}
+static void kBranch(uint64_t n){
+	asm volatile(
+	"xor             %%ecx, %%ecx\n\t"
+	"0:\n\t"
+	"movzbl          (%1,%%rcx), %%eax\n\t"
+	"test            %%eax, %%eax\n\t"
+	"jz              1f\n\t"
+	"add             $1, %%r8\n\t"
+	"1:\n\t"
+	"inc             %%ecx\n\t"
+	"and             $4095, %%ecx\n\t"
+	"dec             %0\n\t"
+	"jnz             0b\n\t"
+	: "+r"(n)
+	: "r"(brData)
+	: "rax", "rcx", "r8", "cc"
+	);
+}
+
+/**
+ * Plain C SAXPY over 1024 floats: The one kernel whose instruction stream is
+ * chosen by the compiler, and therefore the canary for compiler upgrades.
+ */
+
+static void kSaxpy(uint64_t n){
+	uint64_t i;
+	int      j;
+	for(i=0;i<n;i++){
+		for(j=0;j<1024;j++){
+			saxpyY[j] = 1.0001f*saxpyX[j] + saxpyY[j];
+		}
+		asm volatile("" ::: "memory");
+	}
+}
+
+/**
+ * Whether the processor and OS support AVX2 and FMA.
+ */
+
+static int  hasFma(void){
+	unsigned a, b, c, d, xcr0lo, xcr0hi;
+
+	__cpuid(1, a, b, c, d);
+	if(!(c & (1u<<12)) || !(c & (1u<<27)) || !(c & (1u<<28))){
+		return 0;
+	}
+	asm volatile("xgetbv" : "=a"(xcr0lo), "=d"(xcr0hi) : "c"(0));
+	return (xcr0lo & 0x6) == 0x6;
+}
+
+static const KERNEL KERNELS[] = {
+	{"alu_tput",  "4 independent ADD chains",        100000000, NULL,   NULL,          kAluTput },
+	{"alu_lat",   "1 dependent ADD chain",            25000000, NULL,   NULL,          kAluLat  },
+	{"fma_tput",  "pfcdemo FMA+VPADDD mix",           10000000, hasFma, NULL,          kFmaTput },
+	{"fma_lat",   "1 dependent FMA chain",             5000000, hasFma, NULL,          kFmaLat  },
+	{"load_lat",  "L1 pointer chase",                  5000000, NULL,   kLoadLatSetup, kLoadLat },
+	{"store_fwd", "Store-to-load forwarding chain",    5000000, NULL,   NULL,          kStoreFwd},
+	{"branch",    "Branch on random data",            20000000, NULL,   kBranchSetup,  kBranch  },
+	{"saxpy_c",   "Compiler-generated SAXPY",            20000, NULL,   NULL,          kSaxpy   },
+	{NULL,        NULL,                                      0, NULL,   NULL,          NULL     }
+};
+
+
+/* Helpers */
+
+/**
+ * Sort doubles ascending. Used to take medians.
+ */
+
+static int  cmpDouble(const void* a, const void* b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Get the processor brand string, with runs of whitespace squeezed.
+ */
+
+static void getCpuModel(char* buf, size_t len){
+	unsigned r[12];
+	char     raw[49], *p, *q;
+
+	__cpuid(0x80000002, r[0], r[1], r[ 2], r[ 3]);
+	__cpuid(0x80000003, r[4], r[5], r[ 6], r[ 7]);
+	__cpuid(0x80000004, r[8], r[9], r[10], r[11]);
+	memcpy(raw, r, 48);
+	raw[48] = '\0';
+
+	for(p=raw;isspace((unsigned char)*p);p++){}
+	for(q=buf;*p && q<buf+len-1;p++){
+		if(!isspace((unsigned char)*p) || (q>buf && !isspace((unsigned char)q[-1]))){
+			*q++ = *p;
+		}
+	}
+	while(q>buf && isspace((unsigned char)q[-1])){q--;}
+	*q = '\0';
+}
+
+/**
+ * Get the compiler identification string.
+ */
+
+static const char* getCompiler(void){
+#if defined(__clang__)
+	return "clang " __clang_version__;
+#elif defined(__GNUC__)
+	return "gcc " __VERSION__;
+#else
+	return "unknown";
+#endif
+}
+
+/**
+ * Turn an arbitrary string into something usable in a filename.
+ */
+
+static void sanitize(char* dst, const char* src, size_t len){
+	size_t i;
+	for(i=0;src[i] && i<len-1;i++){
+		dst[i] = isalnum((unsigned char)src[i]) || src[i] == '.' ? src[i] : '_';
+	}
+	dst[i] = '\0';
+}
+
+/**
+ * Measure one kernel, writing the median per-iteration count of every counter.
+ */
+
+static void measure(const KERNEL* k, int reps, double* out){
+	static const PFC_CNT ZERO_CNT[7] = {0,0,0,0,0,0,0};
+	PFC_CNT cnt[7];
+	double  vals[7][MAXREPS];
+	int     r, i;
+
+	if(k->setup){
+		k->setup();
+	}
+
+	pfcWrCnts(0, 7, ZERO_CNT);
+	k->run(k->iters/10+1);
+
+	for(r=0;r<reps;r++){
+		memset(cnt, 0, sizeof(cnt));
+
+		PFCSTART(cnt);
+		k->run(k->iters);
+		PFCEND  (cnt);
+
+		pfcRemoveBias(cnt, 1);
+		for(i=0;i<7;i++){
+			vals[i][r] = (double)cnt[i] / k->iters;
+		}
+	}
+
+	for(i=0;i<7;i++){
+		qsort(vals[i], reps, sizeof(double), cmpDouble);
+		out[i] = vals[i][reps/2];
+	}
+}
+
+/**
+ * Write a string as a JSON string literal. The brand string and compiler
+ * version are free text; Escape quotes, backslashes and control characters.
+ */
+
+static void writeJsonStr(FILE* f, const char* s){
+	fputc('"', f);
+	for(;*s;s++){
+		if(*s == '"' || *s == '\\'){
+			fprintf(f, "\\%c", *s);
+		}else if((unsigned char)*s < 0x20){
+			fprintf(f, "\\u%04x", (unsigned char)*s);
+		}else{
+			fputc(*s, f);
+		}
+	}
+	fputc('"', f);
+}
+
+/**
+ * Write the results of all kernels that ran as JSON, one kernel per line.
+ */
+
+static void writeJson(FILE* f, const char* cpu, const int* ran, double res[][7]){
+	int i, j, n = 0;
+
+	fprintf(f, "{\"cpu\": ");
+	writeJsonStr(f, cpu);
+	fprintf(f, ", \"compiler\": ");
+	writeJsonStr(f, getCompiler());
+	fprintf(f, ", \"kernels\": [\n");
+	for(i=0;KERNELS[i].name;i++){
+		if(!ran[i]){
+			continue;
+		}
+		fprintf(f, "%s{\"name\": \"%s\", \"iters\": %llu, \"counters\": {",
+		        n++ ? ",\n" : "", KERNELS[i].name, (unsigned long long)KERNELS[i].iters);
+		for(j=0;j<7;j++){
+			fprintf(f, "%s\"%s\": %.6f", j ? ", " : "", CNTNAMES[j], res[i][j]);
+		}
+		fprintf(f, "}}");
+	}
+	fprintf(f, "\n]}\n");
+}
+
+/**
+ * Look up a kernel's counters in a baseline file.
+ *
+ * The file is the JSON written by this program, which places each kernel on
+ * a line of its own; Parse just that much.
+ *
+ * Returns 1 if found, 0 otherwise.
+ */
+
+static int  readBaseline(FILE* f, const char* name, double* out){
+	char        line[MAXLINE], key[256];
+	const char* p;
+	int         i, found = 0;
+
+	rewind(f);
+	snprintf(key, sizeof(key), "{\"name\": \"%s\",", name);
+	while(fgets(line, sizeof(line), f)){
+		if(!strstr(line, key)){
+			continue;
+		}
+		found = 1;
+		for(i=0;i<7;i++){
+			snprintf(key, sizeof(key), "\"%s\": ", CNTNAMES[i]);
+			p = strstr(line, key);
+			out[i] = p ? strtod(p+strlen(key), NULL) : NAN;
+		}
+		break;
+	}
+
+	return found;
+}
+
+
+/**
+ * Main
+ */
+
+int main(int argc, char* argv[]){
+	int           i, j, option, ret, nfail = 0;
+	int           core = -1, reps = 5, record = 0;
+	double        tol = 0.02, slack = 0.02;
+	const char*   only = NULL;
+	const char*   baseDir = NULL;
+	const char*   outPath = NULL;
+	char          cpu[49], key[256], path[4096], tmp[128];
+	FILE*         f;
+	FILE*         base = NULL;
+	PFC_CFG       cfg[7] = {2,2,2,0,0,0,0};
+	PFC_CFG       got[7];
+	int           ran[sizeof(KERNELS)/sizeof(*KERNELS)] = {0};
+	double        res[sizeof(KERNELS)/sizeof(*KERNELS)][7], ref[7];
+	const KERNEL* k;
+
+
+	/**
+	 * Process command line arguments
+	 */
+
+	while((option = getopt(argc, argv, "c:r:t:s:k:b:o:Rh")) != -1){
+		switch(option){
+			case 'c': core    = strtol(optarg, 0, 0); break;
+			case 'r': reps    = strtol(optarg, 0, 0); break;
+			case 't': tol     = strtod(optarg, 0);    break;
+			case 's': slack   = strtod(optarg, 0);    break;
+			case 'k': only    = optarg;               break;
+			case 'b': baseDir = optarg;               break;
+			case 'o': outPath = optarg;               break;
+			case 'R': record  = 1;                    break;
+			default:
+				fprintf(stderr, "Usage: pfcbench [-c core] [-r reps] [-k kernel] [-o out.json]\n"
+				                "                [-b baselinedir [-R] [-t tol] [-s slack]]\n"
+				                "\t-c\n\t\tCore to run on (default: current)\n"
+				                "\t-r\n\t\tRepetitions per kernel; the median is kept (default 5)\n"
+				                "\t-k\n\t\tRun only the named kernel\n"
+				                "\t-o\n\t\tWrite JSON results to this file (default stdout)\n"
+				                "\t-b\n\t\tDirectory of baselines, one file per CPU model and compiler\n"
+				                "\t-R\n\t\tRecord the results as the new baseline\n"
+				                "\t-t\n\t\tRelative tolerance before a counter is a regression (default 0.02)\n"
+				                "\t-s\n\t\tAbsolute per-iteration slack added to the tolerance (default 0.02)\n");
+			exit(option == 'h' ? 0 : 1);
+		}
+	}
+	reps = reps < 1 ? 1 : reps > MAXREPS ? MAXREPS : reps;
+
+
+	/**
+	 * Initialize library.
+	 */
+
+	pfcPinThread(core >= 0 ? core : sched_getcpu());
+	if((ret = pfcInit()) != 0){
+		fprintf(stderr, "pfcbench: %s Skipping.\n", pfcErrorString(ret));
+		return EXIT_SKIP;
+	}
+	for(i=3;i<7;i++){
+		cfg[i] = pfcParseCfg(CNTNAMES[i]);
+	}
+	/* An event pfc.ko disabled would read as 0, an improvement; Refuse it. */
+	if((ret = pfcWrCfgs(0, 7, cfg)) == 0 && pfcRdCfgs(0, 7, got) == sizeof(got)){
+		for(i=3;i<7;i++){
+			ret = cfg[i] && !got[i] ? PFC_ERR_CFG_REJECTED : ret;
+		}
+	}
+	if(ret != 0){
+		fprintf(stderr, "pfcbench: Could not program the counters: %s\n", pfcErrorString(ret));
+		return 1;
+	}
+
+
+	/**
+	 * Run every kernel.
+	 */
+
+	for(i=0;KERNELS[i].name;i++){
+		k = &KERNELS[i];
+		if((only && strcmp(only, k->name) != 0) || (k->avail && !k->avail())){
+			continue;
+		}
+		measure(k, reps, res[i]);
+		ran[i] = 1;
+	}
+
+	getCpuModel(cpu, sizeof(cpu));
+	f = outPath ? fopen(outPath, "w") : stdout;
+	if(!f){
+		fprintf(stderr, "pfcbench: Could not open %s!\n", outPath);
+		return 1;
+	}
+	writeJson(f, cpu, ran, res);
+	if(f != stdout){
+		fclose(f);
+	}
+
+
+	/**
+	 * Compare against, or record, the baseline named after CPU model and
+	 * compiler.
+	 */
+
+	if(baseDir){
+		sanitize(key, cpu,           sizeof(key));
+		sanitize(tmp, getCompiler(), sizeof(tmp));
+		snprintf(path, sizeof(path), "%s/%s--%s.json", baseDir, key, tmp);
+
+		if(record){
+			if(!(f = fopen(path, "w"))){
+				fprintf(stderr, "pfcbench: Could not open %s!\n", path);
+				return 1;
+			}
+			writeJson(f, cpu, ran, res);
+			fclose(f);
+			fprintf(stderr, "pfcbench: Recorded baseline %s\n", path);
+		}else if(!(base = fopen(path, "r"))){
+			fprintf(stderr, "pfcbench: No baseline %s; Run with -R to record one.\n", path);
+		}else{
+			for(i=0;KERNELS[i].name;i++){
+				if(!ran[i] || !readBaseline(base, KERNELS[i].name, ref)){
+					continue;
+				}
+				for(j=0;j<7;j++){
+					/* Reference cycles track frequency, not code; Don't judge them. */
+					if(j == PFC_FIXEDCNT_CPU_CLK_REF_TSC || isnan(ref[j])){
+						continue;
+					}
+					if(res[i][j] > ref[j]*(1+tol) + slack){
+						fprintf(stderr, "pfcbench: REGRESSION %-10s %-30s %12.4f -> %12.4f /iter\n",
+						        KERNELS[i].name, CNTNAMES[j], ref[j], res[i][j]);
+						nfail++;
+					}else if(res[i][j] < ref[j]*(1-tol) - slack){
+						fprintf(stderr, "pfcbench: improved   %-10s %-30s %12.4f -> %12.4f /iter\n",
+						        KERNELS[i].name, CNTNAMES[j], ref[j], res[i][j]);
+					}
+				}
+			}
+			fclose(base);
+		}
+	}
+
+
+	/**
+	 * Close up shop
+	 */
+
+	pfcFini();
+	return nfail ? 1 : 0;
+}
@@ -0,0 +1,201 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+
+/* Defines */
+#define MAXEVT                             4
+
+
+/* Global data */
+static volatile sig_atomic_t stop = 0;
+
+
+
+/* Static Function Definitions */
+
+static void            pfccollectStop   (int sig){
+	(void)sig;
+	stop = 1;
+}
+
+/**
+ * Read the counters of the nsel CPUs in sel into cnt, all at once if possible
+ * or else one CPU at a time, flagging in ok those that could be read.
+ *
+ * Returns the number of CPUs read.
+ */
+
+static int             pfccollectRead   (const int* sel, int nsel, PFC_CNT (*cnt)[7], char* ok){
+	int i, nok = 0;
+
+	if(pfcRdCntsOnSet(sel, nsel, cnt) == 0){
+		memset(ok, 1, nsel);
+		return nsel;
+	}
+	for(i=0;i<nsel;i++){
+		ok[i] = pfcRdCntsOn(sel[i], 0, 7, cnt[i]) == (int)sizeof(cnt[i]);
+		nok  += ok[i];
+	}
+	return nok;
+}
+
+
+/**
+ * Main
+ */
+
+int main(int argc, char* argv[]){
+	int             i, k, option, ret, ncpus, nok, nsel = 0, nevt = 0;
+	int*            sel;
+	char*           ok, *seen;
+	long            periodMs = 1000, failed = 0;
+	const char*     path = PFC_SHM_PATH;
+	const char*     evts[MAXEVT];
+	PFC_CFG         cfg[7] = {3,3,3,0,0,0,0};
+	uint64_t        masks[7];
+	PFC_CNT       (*cur)[7], (*prev)[7], (*tot)[7];
+	PFC_SHM*        m;
+	cpu_set_t       aff;
+	struct timespec ts;
+
+
+	/**
+	 * Process command line arguments
+	 */
+
+	while((option = getopt(argc, argv, "p:o:e:h")) != -1){
+		switch(option){
+			case 'p': periodMs = strtol(optarg, 0, 0); break;
+			case 'o': path     = optarg;               break;
+			case 'e':
+				if(nevt >= MAXEVT){
+					fprintf(stderr, "pfccollect: At most %d events!\n", MAXEVT);
+					return 1;
+				}
+				evts[nevt++] = optarg;
+			break;
+			default:
+				fprintf(stderr, "Usage: pfccollect [-p periodMs] [-o file] [-e event]...\n"
+				                "\t-p\n\t\tPublishing period in ms (default 1000)\n"
+				                "\t-o\n\t\tExport file (default " PFC_SHM_PATH ")\n"
+				                "\t-e\n\t\tGeneral-purpose counter event, as for pfcParseCfg() (up to 4)\n");
+			exit(option == 'h' ? 0 : 1);
+		}
+	}
+	if(periodMs < 1){
+		fprintf(stderr, "pfccollect: Period must be at least 1 ms!\n");
+		return 1;
+	}
+	for(i=0;i<nevt;i++){
+		if(!(cfg[3+i] = pfcParseCfg(evts[i]))){
+			fprintf(stderr, "pfccollect: Unknown event '%s'!\n", evts[i]);
+			return 1;
+		}
+	}
+
+
+	/**
+	 * Program every CPU we may run on, once, and note their initial counts.
+	 */
+
+	if((ret = pfcInit()) != 0){
+		fprintf(stderr, "pfccollect: %s\n", pfcErrorString(ret));
+		return 1;
+	}
+	ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	if(sched_getaffinity(0, sizeof(aff), &aff) != 0 || ncpus <= 0){
+		fprintf(stderr, "pfccollect: Could not list CPUs!\n");
+		return 1;
+	}
+	sel  = calloc(ncpus, sizeof(*sel));
+	ok   = calloc(ncpus, sizeof(*ok));
+	seen = calloc(ncpus, sizeof(*seen));
+	cur  = calloc(ncpus, sizeof(*cur));
+	prev = calloc(ncpus, sizeof(*prev));
+	tot  = calloc(ncpus, sizeof(*tot));
+	if(!sel || !ok || !seen || !cur || !prev || !tot){
+		fprintf(stderr, "pfccollect: Out of memory!\n");
+		return 1;
+	}
+	for(i=0;i<ncpus && i<CPU_SETSIZE;i++){
+		if(CPU_ISSET(i, &aff)){
+			sel[nsel++] = i;
+		}
+	}
+	if((ret = pfcWrCfgsAll(0, 7, cfg)) != 0){
+		fprintf(stderr, "pfccollect: %s\n", pfcErrorString(ret));
+		return 1;
+	}
+	pfcRdMasks(0, 7, masks);
+	if(pfccollectRead(sel, nsel, prev, ok) == 0){
+		fprintf(stderr, "pfccollect: Could not read remote counts; Is pfc.ko up to date?\n");
+		return 1;
+	}
+	memcpy(seen, ok, nsel);
+	if(!(m = pfcShmCreate(path, ncpus, periodMs*1000000ULL, cfg))){
+		fprintf(stderr, "pfccollect: Could not create %s!\n", path);
+		return 1;
+	}
+
+
+	/**
+	 * Accumulate the masked counter deltas of every CPU into 64 bits, and
+	 * publish them each period until told to stop. A CPU that could not be
+	 * read keeps its last published totals, and the period is reported; One
+	 * never read before starts counting from its first successful read.
+	 */
+
+	signal(SIGINT,  pfccollectStop);
+	signal(SIGTERM, pfccollectStop);
+	signal(SIGHUP,  pfccollectStop);
+	ts.tv_sec  = periodMs / 1000;
+	ts.tv_nsec = periodMs % 1000 * 1000000;
+	while(!stop){
+		if((nok = pfccollectRead(sel, nsel, cur, ok)) < nsel){
+			fprintf(stderr, "pfccollect: Could not read %d of %d CPUs this period!\n",
+			        nsel-nok, nsel);
+			failed++;
+		}
+		for(i=0;i<nsel;i++){
+			if(!ok[i]){
+				continue;
+			}
+			for(k=0;k<7;k++){
+				tot[i][k] += seen[i] ? (cur[i][k] - prev[i][k]) & masks[k] : 0;
+				prev[i][k] = cur[i][k];
+			}
+			seen[i] = 1;
+			pfcShmPublish(m, sel[i], __rdtsc(), tot[i]);
+		}
+		nanosleep(&ts, NULL);
+	}
+	__atomic_store_n(&m->periodNs, 0, __ATOMIC_RELEASE);
+	if(failed){
+		fprintf(stderr, "pfccollect: %ld periods incomplete.\n", failed);
+	}
+
+
+	/**
+	 * Cleanup
+	 */
+
+	pfcShmClose(m);
+	free(sel);
+	free(ok);
+	free(seen);
+	free(cur);
+	free(prev);
+	free(tot);
+	return 0;
+}
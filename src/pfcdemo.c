@@ -63,13 +63,17 @@ static const int         NUMCOUNTS;
 int main(int argc, char* argv[]){
 	int i;
 	
-	int verbose = 0, dump = 0, option;
+	int verbose = 0, dump = 0, core = -1, option;
+	PFC_PLACEMENT place;
 
 	/**
 	 * Process command line arguments
 	 */
-	while ((option = getopt(argc, argv, "dv")) != -1) {
+	while ((option = getopt(argc, argv, "c:dv")) != -1) {
 		switch (option) {
+		case 'c':
+			core = atoi(optarg);
+			break;
 		case 'v':
 			verbose = 1;
 			break;
@@ -77,15 +81,14 @@ int main(int argc, char* argv[]){
 			dump = 1;
 			break;
 		default:
-			fprintf(stderr, "Usage: pfcdemo [-d] [-v]\n"
+			fprintf(stderr, "Usage: pfcdemo [-c core] [-d] [-v]\n"
+					"\t-c core\n\t\tRun on the given core instead of the quietest one\n"
 					"\t-d\n\t\tDump the list of available events and quit\n"
 					"\t-v\n\t\tVerbose output\n");
 			exit(1);
 		}
 	}
 
-	(void)verbose;
-
 	if(dump){
 			pfcDumpEvts();
 			exit(1);
@@ -95,7 +98,16 @@ int main(int argc, char* argv[]){
 	 * Initialize library.
 	 */
 	
-	pfcPinThread(3);
+	if(core >= 0){
+		if(pfcPinThread(core) != 0){
+			printf("Could not pin to core %d\n", core);
+			exit(1);
+		}
+	}else if(pfcPlace(0, &place) == 0){
+		if(verbose){
+			printf("Placement: %s\n", place.report);
+		}
+	}
 	if(pfcInit() != 0){
 		printf("Could not open /sys/module/pfc/* handles; Is module loaded?\n");
 		exit(1);
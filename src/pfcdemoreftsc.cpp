@@ -3,7 +3,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include "libpfc.h"
+#include "libpfc.hpp"
 #include <chrono>
 #include <sched.h>
 #include <unistd.h>
@@ -49,7 +49,7 @@ int main(int argc, char* argv[]){
 	int      CORE              = 0;
 	FILE*    LOG               = NULL;
 	int      i, ret, isterminal = isatty(1);
-	uint64_t maxNonTurbo = 0;
+	const PFC_CLK* clk;
 	uint64_t miscEn = 0, platInfo = 0, tempTarget = 0,
 	         throttleReason, pkgThermStatus, pkgThermInterrupt;
 	PFC_CFG  cfg[7] = {7,7,7,0,0,0,0};
@@ -106,18 +106,22 @@ int main(int argc, char* argv[]){
 	printf("MSR_IA32_TEMPERATURE_TARGET = %016llx\n", (unsigned long long)tempTarget);
 	
 	
-	/* On many newer processors, XCLK runs at 100MHz. That's what we assume here. */
-	maxNonTurbo      = (platInfo >> 8) & 0xFF;
-	CALIBRATION_ADDS = CALIBRATION_NANOS*maxNonTurbo/10;
+	/* Determine clock domains; The add loop runs at 1 iteration per nominal CC. */
+	clk              = pfcClkInit();
+	CALIBRATION_ADDS = CALIBRATION_NANOS*clk->nominalHz/1e9;
+	printf("TSC     frequency (MHz)     = %16.2f (source %d)\n", clk->tscHz/1e6, clk->tscSrc);
+	printf("Nominal frequency (MHz)     = %16.2f\n", clk->nominalHz /1e6);
+	printf("XCLK    frequency (MHz)     = %16.2f\n", clk->xclkHz    /1e6);
+	printf("Measured TSC freq (MHz)     = %16.2f\n", clk->measuredHz/1e6);
 	
 	
 	/* Configure a couple counters. */
 	/*   Reference XCLK */
-	cfg[3]  = pfcParseCfg("cpu_clk_unhalted.ref_xclk:auk");
+	cfg[3]  = PFC_CFG_CONST("cpu_clk_unhalted.ref_xclk:auk");
 	/*   OS-mode Core Clocks, serves as a loose measure of kernel overhead. */
-	cfg[4]  = pfcParseCfg("cpu_clk_unhalted.core_clk:k");
+	cfg[4]  = PFC_CFG_CONST("cpu_clk_unhalted.core_clk:k");
 	/*    User-OS Transition Count */
-	cfg[5]  = pfcParseCfg("*cpl_cycles.ring0>=1:uk");
+	cfg[5]  = PFC_CFG_CONST("*cpl_cycles.ring0>=1:uk");
 	pfcWrCfgs(0, 7, cfg);
 	pfcWrCnts(0, 7, cnt);
 	
@@ -144,9 +148,9 @@ int main(int argc, char* argv[]){
 		printf("CPU %d, measured CLK_REF_TSC MHz        : %16.2f\n",  sched_getcpu(), 1000.0 * cnt[PFC_FIXEDCNT_CPU_CLK_REF_TSC] / delta);
 		printf("CPU %d, measured rdtsc MHz              : %16.2f\n",  sched_getcpu(), 1000.0 * tsc_delta / delta);
 		printf("CPU %d, measured add   MHz              : %16.2f\n",  sched_getcpu(), 1000.0 * CALIBRATION_ADDS / delta);
-		printf("CPU %d, measured XREF_CLK  time (s)     : %16.8f\n",  sched_getcpu(), cnt[3]/1e8);
+		printf("CPU %d, measured XREF_CLK  time (s)     : %16.8f\n",  sched_getcpu(), pfcXclkToNs(cnt[3])/1e9);
 		printf("CPU %d, measured delta     time (s)     : %16.8f\n",  sched_getcpu(), delta/1e9);
-		printf("CPU %d, measured tsc_delta time (s)     : %16.8f\n",  sched_getcpu(), tsc_delta/2.4e9);
+		printf("CPU %d, measured tsc_delta time (s)     : %16.8f\n",  sched_getcpu(), pfcTscToNs(tsc_delta)/1e9);
 		printf("CPU %d, ratio ref_tsc :ref_xclk         : %16.8f\n",  sched_getcpu(), (double)cnt[PFC_FIXEDCNT_CPU_CLK_REF_TSC]/cnt[3]);
 		printf("CPU %d, ratio ref_core:ref_xclk         : %16.8f\n",  sched_getcpu(), (double)cnt[PFC_FIXEDCNT_CPU_CLK_UNHALTED]/cnt[3]);
 		printf("CPU %d, ratio rdtsc   :ref_xclk         : %16.8f\n",  sched_getcpu(), (double)tsc_delta/cnt[3]);
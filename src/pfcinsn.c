@@ -0,0 +1,543 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <cpuid.h>
+#include <dlfcn.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* Defines */
+
+/**
+ * Exit code understood by Meson as "skipped", used when pfc.ko is absent.
+ */
+
+#define EXIT_SKIP                         77
+
+#define MAXFORMS                          256
+#define MAXLINE                           256
+
+/**
+ * Instances of the form per loop iteration, which is also the number of
+ * independent streams in the throughput kernel.
+ */
+
+#define UNROLL                            12
+
+
+/* Data Structures */
+struct REGCLASS;
+typedef struct REGCLASS REGCLASS;
+struct FORM;
+typedef struct FORM FORM;
+struct RUN;
+typedef struct RUN RUN;
+
+/**
+ * A register class usable in forms as {name}: UNROLL chain registers and one
+ * source register that the kernels never write.
+ */
+
+struct REGCLASS{
+	const char*   name;
+	const char*   chain[UNROLL];
+	const char*   src;
+	int           vec;     /* 0: GPR, 1: XMM (SSE), 2: YMM/ZMM (AVX) */
+};
+
+struct FORM{
+	char          text[MAXLINE];
+	int           latOk;
+	double        lat, tput;
+	double        issued, retired;
+	double        port[8];
+};
+
+/**
+ * One measured run: Kernel fn for n iterations.
+ */
+
+struct RUN{
+	void        (*fn)(uint64_t n);
+	uint64_t      n;
+};
+
+
+/* Global data */
+static const REGCLASS REGCLASSES[] = {
+	{"r64", {"rax", "rbx", "rcx", "rdx", "rsi", "r8",  "r9",  "r10",  "r11",  "r12",  "r14",  "r15"},  "r13",  0},
+	{"r32", {"eax", "ebx", "ecx", "edx", "esi", "r8d", "r9d", "r10d", "r11d", "r12d", "r14d", "r15d"}, "r13d", 0},
+	{"xmm", {"xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11"}, "xmm15", 1},
+	{"ymm", {"ymm0", "ymm1", "ymm2", "ymm3", "ymm4", "ymm5", "ymm6", "ymm7", "ymm8", "ymm9", "ymm10", "ymm11"}, "ymm15", 2},
+	{"zmm", {"zmm0", "zmm1", "zmm2", "zmm3", "zmm4", "zmm5", "zmm6", "zmm7", "zmm8", "zmm9", "zmm10", "zmm11"}, "zmm15", 2},
+	{NULL,  {NULL},                                                                                      NULL,   0}
+};
+
+/**
+ * Three groups of general-purpose events, under which every throughput
+ * kernel is measured in turn.
+ */
+
+static const char* const EVTGROUPS[3][4] = {
+	{"uops_issued.any",           "uops_retired.all",
+	 "uops_executed_port.port_0", "uops_executed_port.port_1"},
+	{"uops_executed_port.port_2", "uops_executed_port.port_3",
+	 "uops_executed_port.port_4", "uops_executed_port.port_5"},
+	{"uops_executed_port.port_6", "uops_executed_port.port_7",
+	 "",                          ""},
+};
+
+static FORM forms[MAXFORMS];
+static int  nforms = 0;
+
+
+/* Helpers */
+
+static const REGCLASS* findClass(const char* name, size_t len){
+	int i;
+	for(i=0;REGCLASSES[i].name;i++){
+		if(strlen(REGCLASSES[i].name) == len && strncmp(REGCLASSES[i].name, name, len) == 0){
+			return &REGCLASSES[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Whether the processor and OS support AVX-512F, with the OS saving the
+ * opmask and ZMM state; As pfcsimd checks before its {zmm} kernels.
+ */
+
+static int  hasAvx512(void){
+	unsigned a, b, c, d, xcr0lo, xcr0hi;
+
+	__cpuid(1, a, b, c, d);
+	if(!(c & (1u<<27)) || !(c & (1u<<28))){
+		return 0;
+	}
+	asm volatile("xgetbv" : "=a"(xcr0lo), "=d"(xcr0hi) : "c"(0));
+	__cpuid_count(7, 0, a, b, c, d);
+	return (b & (1u<<16)) && (xcr0lo & 0xE6) == 0xE6;
+}
+
+/**
+ * Expand the placeholders of form f for instance k of a kernel.
+ *
+ * In the latency kernel every register placeholder becomes chain register 0
+ * of its class, so that each instance depends on the last. In the throughput
+ * kernel the destination (the last register placeholder, AT&T order) becomes
+ * chain register k and every other one the class' source register. {m} is a
+ * scratch slot in the red zone.
+ *
+ * Returns 0, or -1 on an unknown placeholder.
+ */
+
+static int  expand(FILE* out, const FORM* f, int lat, int k){
+	const char*     s = f->text, *e, *last = NULL;
+	const REGCLASS* c;
+
+	for(e=s;(e=strchr(e, '{'));e++){
+		if(strncmp(e, "{m}", 3) != 0){
+			last = e;
+		}
+	}
+
+	fputc('\t', out);
+	while(*s){
+		if(*s != '{'){
+			fputc(*s++, out);
+			continue;
+		}
+		if(!(e = strchr(s, '}'))){
+			return -1;
+		}
+		if(e-s-1 == 1 && s[1] == 'm'){
+			fputs("-64(%rsp)", out);
+		}else if((c = findClass(s+1, e-s-1))){
+			fprintf(out, "%%%s", lat ? c->chain[0] : s == last ? c->chain[k] : c->src);
+		}else{
+			return -1;
+		}
+		s = e+1;
+	}
+	fputc('\n', out);
+	return 0;
+}
+
+/**
+ * Whether the latency kernel chains: The destination's class appears again
+ * among the sources, or the destination is the sole operand (and thus also
+ * read, as by inc or neg).
+ */
+
+static int  chains(const FORM* f){
+	const REGCLASS* c, *cls[MAXLINE/2];
+	const char*     s, *e;
+	int             i, nreg = 0;
+
+	for(s=f->text;(s=strchr(s, '{')) && (e=strchr(s, '}'));s=e){
+		if((c = findClass(s+1, e-s-1))){
+			cls[nreg++] = c;
+		}
+	}
+	if(nreg == 0){
+		return 0;
+	}
+	for(i=0;i<nreg-1;i++){
+		if(cls[i] == cls[nreg-1]){
+			return 1;
+		}
+	}
+	return !strchr(f->text, ',');
+}
+
+/**
+ * Emit one kernel: void fn(uint64_t n), running n iterations of UNROLL
+ * instances of form f, or none (the loop-overhead kernel) if f is NULL.
+ */
+
+static int  emitKernel(FILE* out, const char* name, const FORM* f, int lat){
+	static const char* const SAVED[] = {"rbx", "r12", "r13", "r14", "r15"};
+	int i, k, vec = 0;
+
+	for(i=0;f && REGCLASSES[i].name;i++){
+		if(REGCLASSES[i].vec > vec && strstr(f->text, REGCLASSES[i].name)){
+			vec = REGCLASSES[i].vec;
+		}
+	}
+	if(vec == 1 && f->text[0] == 'v'){
+		vec = 2;/* VEX-encoded XMM form */
+	}
+
+	fprintf(out, "\t.globl %s\n\t.type %s, @function\n%s:\n", name, name, name);
+	for(i=0;i<5;i++){
+		fprintf(out, "\tpush %%%s\n", SAVED[i]);
+	}
+	for(i=0;i<UNROLL;i++){
+		fprintf(out, "\tmov $1, %%%s\n", REGCLASSES[0].chain[i]);
+	}
+	fprintf(out, "\tmov $1, %%%s\n", REGCLASSES[0].src);
+	if(vec == 2){
+		fprintf(out, "\tvzeroall\n");
+	}else if(vec == 1){
+		for(i=0;i<16;i++){
+			fprintf(out, "\txorps %%xmm%d, %%xmm%d\n", i, i);
+		}
+	}
+
+	fprintf(out, "0:\n");
+	for(k=0;f && k<UNROLL;k++){
+		if(expand(out, f, lat, k) != 0){
+			return -1;
+		}
+	}
+	fprintf(out, "\tdec %%rdi\n\tjnz 0b\n");
+
+	if(vec == 2){
+		fprintf(out, "\tvzeroupper\n");
+	}
+	for(i=4;i>=0;i--){
+		fprintf(out, "\tpop %%%s\n", SAVED[i]);
+	}
+	fprintf(out, "\tret\n\t.size %s, .-%s\n\n", name, name);
+	return 0;
+}
+
+/**
+ * Generate, assemble and load the kernels of all forms.
+ *
+ * Returns the dlopen() handle, or NULL.
+ */
+
+static void* build(int keep){
+	char  dir[] = "/tmp/pfcinsnXXXXXX", src[64], so[64], cmd[512], name[64];
+	const char* cc = getenv("CC");
+	FILE* out;
+	void* h = NULL;
+	int   i;
+
+	if(!mkdtemp(dir)){
+		return NULL;
+	}
+	snprintf(src, sizeof(src), "%s/kernels.S",  dir);
+	snprintf(so,  sizeof(so),  "%s/kernels.so", dir);
+	if(!(out = fopen(src, "w"))){
+		return NULL;
+	}
+	fprintf(out, "\t.text\n\n");
+	emitKernel(out, "pfcinsn_empty", NULL, 0);
+	for(i=0;i<nforms;i++){
+		snprintf(name, sizeof(name), "pfcinsn_lat_%d",  i);
+		if(emitKernel(out, name, &forms[i], 1) != 0){
+			fprintf(stderr, "pfcinsn: Bad placeholder in '%s'!\n", forms[i].text);
+			fclose(out);
+			return NULL;
+		}
+		snprintf(name, sizeof(name), "pfcinsn_tput_%d", i);
+		emitKernel(out, name, &forms[i], 0);
+	}
+	fprintf(out, "\t.section .note.GNU-stack,\"\",@progbits\n");
+	fclose(out);
+
+	snprintf(cmd, sizeof(cmd), "%s -shared -o %s %s", cc ? cc : "cc", so, src);
+	if(system(cmd) == 0){
+		h = dlopen(so, RTLD_NOW);
+	}
+	if(keep){
+		fprintf(stderr, "pfcinsn: Kernels kept in %s\n", dir);
+	}else{
+		unlink(so);
+		unlink(src);
+		rmdir(dir);
+	}
+	return h;
+}
+
+static void runKernel(void* arg){
+	const RUN* p = arg;
+	p->fn(p->n);
+}
+
+/**
+ * Median count per instance of every counter over reps runs of fn, under
+ * event group g, net of the loop-overhead kernel's counts in base (if given).
+ * Exits if the event group cannot be programmed.
+ */
+
+static void measure(void (*fn)(uint64_t), uint64_t n, int reps, int g,
+                    const double* base, double* out){
+	RUN p = {fn, n};
+	int i, ret;
+
+	if((ret = pfcMeasure(EVTGROUPS[g], runKernel, &p, reps, n*UNROLL, out)) != 0){
+		fprintf(stderr, "pfcinsn: Event group %s, %s, %s, %s: %s\n",
+		        EVTGROUPS[g][0], EVTGROUPS[g][1], EVTGROUPS[g][2],
+		        EVTGROUPS[g][3], pfcErrorString(ret));
+		exit(1);
+	}
+	for(i=3;base && i<7;i++){
+		out[i] -= base[i];
+	}
+}
+
+/**
+ * Look up a kernel in the assembled library, exiting if it is missing.
+ */
+
+static void (*findKernel(void* h, const char* name))(uint64_t){
+	void (*fn)(uint64_t) = (void (*)(uint64_t))dlsym(h, name);
+	if(!fn){
+		fprintf(stderr, "pfcinsn: Kernel %s missing: %s\n", name, dlerror());
+		exit(1);
+	}
+	return fn;
+}
+
+/**
+ * Read forms, one per line, skipping blank lines and # comments.
+ */
+
+static int  readForms(FILE* f){
+	char  line[MAXLINE], *p, *e;
+
+	while(fgets(line, sizeof(line), f)){
+		for(p=line;*p == ' ' || *p == '\t';p++){}
+		for(e=p+strlen(p);e>p && (e[-1] == '\n' || e[-1] == ' ' || e[-1] == '\t');e--){}
+		*e = '\0';
+		if(!*p || *p == '#'){
+			continue;
+		}
+		if(nforms >= MAXFORMS){
+			return -1;
+		}
+		snprintf(forms[nforms++].text, MAXLINE, "%s", p);
+	}
+	return 0;
+}
+
+
+/**
+ * Main
+ */
+
+int main(int argc, char* argv[]){
+	int           i, j, g, option, ret, core = -1, reps = 5, json = 0, keep = 0;
+	uint64_t      n = 100000;
+	double        base[3][7], res[7];
+	const char*   path = NULL;
+	char          name[64];
+	FILE*         f;
+	void*         h;
+	void        (*fn)(uint64_t);
+	PFC_PLACEMENT place;
+
+
+	/**
+	 * Process command line arguments
+	 */
+
+	while((option = getopt(argc, argv, "c:r:n:f:jkh")) != -1){
+		switch(option){
+			case 'c': core = strtol  (optarg, 0, 0); break;
+			case 'r': reps = strtol  (optarg, 0, 0); break;
+			case 'n': n    = strtoull(optarg, 0, 0); break;
+			case 'f': path = optarg;                 break;
+			case 'j': json = 1;                      break;
+			case 'k': keep = 1;                      break;
+			default:
+				fprintf(stderr, "Usage: pfcinsn [-c core] [-r reps] [-n iters] [-f forms.txt] [-j] [-k] ['form'...]\n"
+				                "\t-c\n\t\tCore to run on (default: chosen by pfcPlace())\n"
+				                "\t-r\n\t\tRepetitions per kernel, median reported (default 5, max %d)\n"
+				                "\t-n\n\t\tLoop iterations of %d instances per run (default 100000)\n"
+				                "\t-f\n\t\tRead forms from this file, one per line, - for stdin\n"
+				                "\t-j\n\t\tPrint one JSON object per form instead of CSV\n"
+				                "\t-k\n\t\tKeep the generated kernels\n"
+				                "Forms are AT&T instructions with register placeholders {r64}, {r32},\n"
+				                "{xmm}, {ymm}, {zmm} and a memory placeholder {m}, e.g.\n"
+				                "\t'imul {r64}, {r64}'  'vfmadd231ps {ymm}, {ymm}, {ymm}'  'mov {m}, {r64}'\n"
+				                "The last register placeholder is the destination.\n",
+				                PFC_MEASURE_MAXREPS, UNROLL);
+			exit(option == 'h' ? 0 : 1);
+		}
+	}
+	reps = reps < 1 ? 1 : reps > PFC_MEASURE_MAXREPS ? PFC_MEASURE_MAXREPS : reps;
+	n    = n    < 1 ? 1 : n;
+
+	if(path){
+		f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+		if(!f || readForms(f) != 0){
+			fprintf(stderr, "pfcinsn: Could not read forms from %s!\n", path);
+			return 1;
+		}
+		if(f != stdin){
+			fclose(f);
+		}
+	}
+	for(i=optind;i<argc && nforms<MAXFORMS;i++){
+		snprintf(forms[nforms++].text, MAXLINE, "%s", argv[i]);
+	}
+	if(nforms == 0){
+		fprintf(stderr, "pfcinsn: No instruction forms given!\n");
+		return 1;
+	}
+
+	/**
+	 * Drop {zmm} forms if AVX-512 is missing: Their kernels would fault.
+	 */
+
+	for(i=j=0;i<nforms;i++){
+		if(strstr(forms[i].text, "{zmm}") && !hasAvx512()){
+			fprintf(stderr, "pfcinsn: Skipping '%s': No AVX-512 on this CPU.\n", forms[i].text);
+			continue;
+		}
+		forms[j++] = forms[i];
+	}
+	if((nforms = j) == 0){
+		fprintf(stderr, "pfcinsn: No instruction forms this CPU can run!\n");
+		return 1;
+	}
+	for(i=0;i<nforms;i++){
+		forms[i].latOk = chains(&forms[i]);
+	}
+	if(!(h = build(keep))){
+		fprintf(stderr, "pfcinsn: Could not assemble the kernels!\n");
+		return 1;
+	}
+
+
+	/**
+	 * Initialize library, on a quiet core.
+	 */
+
+	if(core >= 0){
+		pfcPinThread(core);
+	}else{
+		pfcPlace(0, &place);
+	}
+	if((ret = pfcInit()) != 0){
+		fprintf(stderr, "pfcinsn: %s\n", pfcErrorString(ret));
+		exit(ret == PFC_ERR_OPENING_SYSFILE ? EXIT_SKIP : 1);
+	}
+
+
+	/**
+	 * Measure the loop overhead, then every form: Cycles per instance of the
+	 * dependent chain (latency) and of the independent streams (reciprocal
+	 * throughput), and uops and ports per instance, net of the loop.
+	 */
+
+	fn = findKernel(h, "pfcinsn_empty");
+	for(g=0;g<3;g++){
+		measure(fn, n, reps, g, NULL, base[g]);
+	}
+	for(i=0;i<nforms;i++){
+		snprintf(name, sizeof(name), "pfcinsn_lat_%d",  i);
+		fn = findKernel(h, name);
+		measure(fn, n, reps, 0, base[0], res);
+		forms[i].lat = forms[i].latOk ? res[1] : NAN;
+
+		snprintf(name, sizeof(name), "pfcinsn_tput_%d", i);
+		fn = findKernel(h, name);
+		for(g=0;g<3;g++){
+			measure(fn, n, reps, g, base[g], res);
+			if(g == 0){
+				forms[i].tput    = res[1];
+				forms[i].issued  = res[3];
+				forms[i].retired = res[4];
+				forms[i].port[0] = res[5];
+				forms[i].port[1] = res[6];
+			}else if(g == 1){
+				for(j=0;j<4;j++){
+					forms[i].port[2+j] = res[3+j];
+				}
+			}else{
+				forms[i].port[6] = res[3];
+				forms[i].port[7] = res[4];
+			}
+		}
+	}
+
+
+	/**
+	 * Print the table.
+	 */
+
+	if(!json){
+		printf("form,latency,recip_tput,uops_issued,uops_retired,p0,p1,p2,p3,p4,p5,p6,p7\n");
+	}
+	for(i=0;i<nforms;i++){
+		if(json){
+			printf("{\"form\": \"%s\", \"latency\": ", forms[i].text);
+			printf(isnan(forms[i].lat) ? "null" : "%.3f", forms[i].lat);
+			printf(", \"recip_tput\": %.3f, \"uops_issued\": %.3f, \"uops_retired\": %.3f, \"ports\": [",
+			       forms[i].tput, forms[i].issued, forms[i].retired);
+			for(j=0;j<8;j++){
+				printf("%s%.3f", j ? ", " : "", forms[i].port[j]);
+			}
+			printf("]}\n");
+		}else{
+			printf("\"%s\",", forms[i].text);
+			printf(isnan(forms[i].lat) ? "" : "%.3f", forms[i].lat);
+			printf(",%.3f,%.3f,%.3f", forms[i].tput, forms[i].issued, forms[i].retired);
+			for(j=0;j<8;j++){
+				printf(",%.3f", forms[i].port[j]);
+			}
+			printf("\n");
+		}
+	}
+
+
+	/**
+	 * Cleanup
+	 */
+
+	dlclose(h);
+	pfcFini();
+	return 0;
+}
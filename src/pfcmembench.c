@@ -0,0 +1,363 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+/* Defines */
+
+/**
+ * Exit code understood by Meson as "skipped", used when pfc.ko is absent.
+ */
+
+#define EXIT_SKIP                         77
+
+#define LINE                              64
+#define HUGE_2M                           (2UL<<20)
+
+/**
+ * Every measurement touches at least this many lines (pointer chases) or
+ * bytes (streams), so that small buffers are timed over many passes.
+ */
+
+#define MIN_LOADS                         (1UL<<21)
+#define MIN_BYTES                         (256UL<<20)
+
+
+/* Data Structures */
+struct KERNEL;
+typedef struct KERNEL KERNEL;
+struct RUN;
+typedef struct RUN RUN;
+
+struct KERNEL{
+	const char*   name;
+	const char*   desc;
+	int           chase;
+	void        (*run)(char* buf, size_t size, uint64_t n);
+};
+
+/**
+ * One measured point: Kernel k over the first size bytes of buf, n times.
+ */
+
+struct RUN{
+	const KERNEL* k;
+	char*         buf;
+	size_t        size;
+	uint64_t      n;
+};
+
+
+/* Global data */
+
+/**
+ * The fixed counters, then two groups of four general-purpose events, which
+ * every point is measured under in turn: Where the loads were served from,
+ * then the L2 and TLB behaviour behind it.
+ */
+
+static const char* const EVTGROUPS[2][4] = {
+	{"mem_load_uops_retired.l1_hit",
+	 "mem_load_uops_retired.l2_hit",
+	 "mem_load_uops_retired.l3_hit",
+	 "mem_load_uops_retired.l3_miss"},
+	{"l2_rqsts.demand_data_rd_hit",
+	 "l2_rqsts.demand_data_rd_miss",
+	 "dtlb_load_misses.stlb_hit",
+	 "dtlb_load_misses.miss_causes_a_walk"},
+};
+
+static volatile uint64_t sink;
+
+
+/* Kernels */
+
+/**
+ * Follow the ring of pointers laid out by chaseSetup() for n loads: Load-to-use
+ * latency.
+ */
+
+static void kChase(char* buf, size_t size, uint64_t n){
+	void* p = *(void**)buf;
+	(void)size;
+	asm volatile(
+	"0:\n\t"
+	"mov             (%1), %1\n\t"
+	"mov             (%1), %1\n\t"
+	"mov             (%1), %1\n\t"
+	"mov             (%1), %1\n\t"
+	"sub             $4, %0\n\t"
+	"ja              0b\n\t"
+	: "+r"(n), "+r"(p)
+	:
+	: "memory", "cc"
+	);
+	sink = (uint64_t)p;
+}
+
+/**
+ * Read every 8-byte word of the buffer, n times, with four independent sums.
+ */
+
+static void kRead(char* buf, size_t size, uint64_t n){
+	const uint64_t* w = (const uint64_t*)buf;
+	uint64_t        s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+	size_t          i;
+
+	while(n--){
+		for(i=0;i<size/8;i+=4){
+			s0 += w[i]; s1 += w[i+1]; s2 += w[i+2]; s3 += w[i+3];
+		}
+		asm volatile("" ::: "memory");
+	}
+	sink = s0+s1+s2+s3;
+}
+
+/**
+ * Write every byte of the buffer, n times.
+ */
+
+static void kWrite(char* buf, size_t size, uint64_t n){
+	while(n--){
+		memset(buf, (int)n, size);
+		asm volatile("" ::: "memory");
+	}
+}
+
+/**
+ * Copy the first half of the buffer onto the second, n times.
+ */
+
+static void kCopy(char* buf, size_t size, uint64_t n){
+	while(n--){
+		memcpy(buf+size/2, buf, size/2);
+		asm volatile("" ::: "memory");
+	}
+}
+
+static const KERNEL KERNELS[] = {
+	{"chase", "Random pointer chase, one line per load",  1, kChase},
+	{"read",  "Streaming read",                            0, kRead },
+	{"write", "Streaming write",                           0, kWrite},
+	{"copy",  "Streaming copy, half onto half",            0, kCopy },
+	{NULL,    NULL,                                        0, NULL  }
+};
+
+
+/* Helpers */
+
+/**
+ * Allocate a prefaulted buffer, from explicit huge pages if any are reserved
+ * or else from transparent huge pages, so that TLB misses only appear once
+ * the buffer outgrows what the TLB covers in 2MiB pages.
+ *
+ * Sets *huge to 2 for hugetlbfs pages, 1 for THP (a hint only), 0 for none.
+ */
+
+static char* allocBuf(size_t size, int* huge){
+	size_t i;
+	char*  p;
+
+	size = (size + HUGE_2M-1) & ~(HUGE_2M-1);
+	p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+	         MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_POPULATE, -1, 0);
+	if(p != MAP_FAILED){
+		*huge = 2;
+		return p;
+	}
+	p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED){
+		return NULL;
+	}
+	*huge = madvise(p, size, MADV_HUGEPAGE) == 0;
+	for(i=0;i<size;i+=4096){
+		p[i] = 1;
+	}
+	return p;
+}
+
+/**
+ * Link the lines of the first size bytes of buf into one random cycle
+ * (Sattolo's algorithm), so that the hardware prefetchers cannot follow it.
+ */
+
+static int  chaseSetup(char* buf, size_t size){
+	size_t  lines = size/LINE, i, j, t;
+	size_t* perm = malloc(lines*sizeof(*perm));
+
+	if(!perm){
+		return -1;
+	}
+	for(i=0;i<lines;i++){
+		perm[i] = i;
+	}
+	srand(1);
+	for(i=lines-1;i>0;i--){
+		j = ((size_t)rand()*RAND_MAX + rand()) % i;
+		t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+	}
+	for(i=0;i<lines;i++){
+		*(void**)(buf + perm[i]*LINE) = buf + perm[(i+1)%lines]*LINE;
+	}
+	free(perm);
+	return 0;
+}
+
+static void runPoint(void* arg){
+	const RUN* p = arg;
+	p->k->run(p->buf, p->size, p->n);
+}
+
+/**
+ * Measure one point under both event groups, writing into out the median
+ * count per unit (load or byte) of the 3 fixed counters and the 8 events.
+ * Exits if an event group cannot be programmed.
+ */
+
+static void measure(const KERNEL* k, char* buf, size_t size, int reps,
+                    double units, uint64_t n, double* out){
+	RUN    p = {k, buf, size, n};
+	double res[7];
+	int    g, i, ret;
+
+	for(g=0;g<2;g++){
+		if((ret = pfcMeasure(EVTGROUPS[g], runPoint, &p, reps, units, res)) != 0){
+			fprintf(stderr, "pfcmembench: Event group %s, %s, %s, %s: %s\n",
+			        EVTGROUPS[g][0], EVTGROUPS[g][1], EVTGROUPS[g][2],
+			        EVTGROUPS[g][3], pfcErrorString(ret));
+			exit(1);
+		}
+		for(i=g?3:0;i<7;i++){
+			out[i < 3 ? i : 3+4*g+i-3] = res[i];
+		}
+	}
+}
+
+
+/**
+ * Main
+ */
+
+int main(int argc, char* argv[]){
+	int           i, j, option, ret, huge, core = -1, reps = 5, json = 0;
+	size_t        size, minSize = 4096, maxSize = 256UL<<20;
+	uint64_t      n;
+	double        units, res[11], ns;
+	const char*   only = NULL;
+	char*         buf;
+	PFC_PLACEMENT place;
+
+
+	/**
+	 * Process command line arguments
+	 */
+
+	while((option = getopt(argc, argv, "c:r:s:S:k:jh")) != -1){
+		switch(option){
+			case 'c': core    = strtol (optarg, 0, 0);        break;
+			case 'r': reps    = strtol (optarg, 0, 0);        break;
+			case 's': minSize = strtoull(optarg, 0, 0) << 10; break;
+			case 'S': maxSize = strtoull(optarg, 0, 0) << 10; break;
+			case 'k': only    = optarg;                       break;
+			case 'j': json    = 1;                            break;
+			default:
+				fprintf(stderr, "Usage: pfcmembench [-c core] [-r reps] [-s minKiB] [-S maxKiB] [-k kernel] [-j]\n"
+				                "\t-c\n\t\tCore to run on (default: chosen by pfcPlace())\n"
+				                "\t-r\n\t\tRepetitions per point, median reported (default 5, max %d)\n"
+				                "\t-s, -S\n\t\tSmallest and largest buffer, in KiB, doubling in between (default 4 and 262144)\n"
+				                "\t-k\n\t\tRun only this kernel (chase, read, write, copy)\n"
+				                "\t-j\n\t\tPrint one JSON object per point instead of a table\n",
+				                PFC_MEASURE_MAXREPS);
+			exit(option == 'h' ? 0 : 1);
+		}
+	}
+	reps    = reps < 1 ? 1 : reps > PFC_MEASURE_MAXREPS ? PFC_MEASURE_MAXREPS : reps;
+	minSize = minSize < 4096 ? 4096 : minSize;
+
+
+	/**
+	 * Initialize library, on a quiet core.
+	 */
+
+	if(core >= 0){
+		pfcPinThread(core);
+	}else{
+		pfcPlace(0, &place);
+	}
+	if((ret = pfcInit()) != 0){
+		fprintf(stderr, "pfcmembench: %s\n", pfcErrorString(ret));
+		exit(ret == PFC_ERR_OPENING_SYSFILE ? EXIT_SKIP : 1);
+	}
+	if(!(buf = allocBuf(maxSize, &huge))){
+		fprintf(stderr, "pfcmembench: Could not allocate %zu bytes!\n", maxSize);
+		return 1;
+	}
+	if(!json){
+		printf("Pages: %s\n", huge == 2 ? "2MiB (hugetlbfs)" :
+		                      huge == 1 ? "transparent huge pages (if available)" : "4KiB");
+		printf("%-6s %10s %9s %9s | %7s %7s %7s %7s | %7s %7s %7s %7s  (per load or line)\n",
+		       "kernel", "KiB", "cyc/unit", "ns|GB/s",
+		       "L1hit", "L2hit", "L3hit", "L3miss", "L2dHit", "L2dMiss", "STLBhit", "walk");
+	}
+
+
+	/**
+	 * Sweep every kernel over the buffer sizes. Latencies are per load;
+	 * Bandwidths are in GB/s, with events normalized per 64-byte line.
+	 */
+
+	for(i=0;KERNELS[i].name;i++){
+		if(only && strcmp(only, KERNELS[i].name) != 0){
+			continue;
+		}
+		for(size=minSize;size<=maxSize;size*=2){
+			if(KERNELS[i].chase){
+				if(chaseSetup(buf, size) != 0){
+					fprintf(stderr, "pfcmembench: Out of memory!\n");
+					return 1;
+				}
+				n     = size/LINE > MIN_LOADS ? size/LINE : MIN_LOADS;
+				units = n;
+			}else{
+				n     = MIN_BYTES/size ? MIN_BYTES/size : 1;
+				units = (double)n*size/LINE;
+			}
+			measure(&KERNELS[i], buf, size, reps, units, n, res);
+			ns = pfcRefToNs((int64_t)(res[2]*units));
+			ns = KERNELS[i].chase ? ns/units : units*LINE/ns;
+
+			if(json){
+				printf("{\"kernel\": \"%s\", \"bytes\": %zu, \"huge\": %d, "
+				       "\"%s\": %.3f, \"cycles\": %.3f",
+				       KERNELS[i].name, size, huge,
+				       KERNELS[i].chase ? "ns_per_load" : "gb_per_s", ns, res[1]);
+				for(j=0;j<8;j++){
+					printf(", \"%s\": %.4f", EVTGROUPS[j/4][j%4], res[3+j]);
+				}
+				printf("}\n");
+			}else{
+				printf("%-6s %10zu %9.2f %9.2f | %7.3f %7.3f %7.3f %7.3f | %7.3f %7.3f %7.3f %7.3f\n",
+				       KERNELS[i].name, size >> 10, res[1], ns,
+				       res[3], res[4], res[5],  res[6],
+				       res[7], res[8], res[9], res[10]);
+			}
+			fflush(stdout);
+		}
+	}
+
+
+	/**
+	 * Cleanup
+	 */
+
+	munmap(buf, (maxSize + HUGE_2M-1) & ~(HUGE_2M-1));
+	pfcFini();
+	return 0;
+}
@@ -0,0 +1,242 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+
+/* Defines */
+
+/**
+ * Timestamp a point in the instruction stream, in both unhalted core cycles
+ * (fixed counter 1, counting user and OS) and TSC ticks. The lfences keep the
+ * measured operation from leaking out of the bracket.
+ */
+
+#define STAMP(cyc, tsc) do{                       \
+	_mm_lfence();                                 \
+	(cyc) = __rdpmc(0x40000001);                  \
+	(tsc) = __rdtsc();                            \
+	_mm_lfence();                                 \
+}while(0)
+
+/**
+ * Run body n times, recording the cost of each run net of the cost of an
+ * empty bracket. MEASURE_TSC() is for bodies that reprogram the fixed
+ * counters, whose cycle counts are meaningless: It reports TSC time only.
+ */
+
+#define MEASURE(name, n, body)     MEASURE_(name, n, body, 1)
+#define MEASURE_TSC(name, n, body) MEASURE_(name, n, body, 0)
+#define MEASURE_(name, n, body, cycOk) do{        \
+	size_t   _i;                                  \
+	uint64_t _c0, _c1, _t0, _t1;                  \
+	for(_i=0;_i<(n)+WARMUP;_i++){                 \
+		STAMP(_c0, _t0);                          \
+		body;                                     \
+		STAMP(_c1, _t1);                          \
+		if(_i >= WARMUP){                         \
+			cyc[_i-WARMUP] = (double)(_c1-_c0) - nullCyc; \
+			tsc[_i-WARMUP] = (double)(_t1-_t0) - nullTsc; \
+		}                                         \
+	}                                             \
+	report(out, (name), cyc, tsc, (n), (cycOk));  \
+}while(0)
+
+#define WARMUP                             16
+
+
+/* Global data */
+static double nullCyc = 0;
+static double nullTsc = 0;
+
+
+/**
+ * Print one line of statistics for cycles and one for nanoseconds. If the
+ * cycles are not valid (cycOk == 0), their line is all dashes.
+ */
+
+static void report(FILE* out, const char* name, const double* cyc, double* tsc, size_t n, int cycOk){
+	PFC_STATS s;
+	double    nsPerTsc = pfcTscToNs(1000000)/1000000;
+	size_t    i;
+
+	if(cycOk){
+		pfcStats(cyc, n, &s);
+		fprintf(out, "%-24s cycles %8zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+		        name, s.n, s.min, s.p50, s.p90, s.p99, s.max, s.mean, s.stddev);
+	}else{
+		fprintf(out, "%-24s cycles %8s %10s %10s %10s %10s %10s %10s %10s\n",
+		        name, "-", "-", "-", "-", "-", "-", "-", "-");
+	}
+
+	for(i=0;i<n;i++){
+		tsc[i] *= nsPerTsc;
+	}
+	pfcStats(tsc, n, &s);
+	fprintf(out, "%-24s ns     %8zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+	        name, s.n, s.min, s.p50, s.p90, s.p99, s.max, s.mean, s.stddev);
+}
+
+
+/**
+ * Main
+ */
+
+int main(int argc, char* argv[]){
+	int            i, option, ret, core = -1;
+	size_t         n = 10000, nSlow = 1000;
+	double*        cyc, *tsc;
+	const char*    outPath = NULL;
+	FILE*          out = stdout;
+	char           name[64];
+	uint64_t       msr;
+	struct utsname uts;
+	PFC_CFG        cfg[7], cfgSave[7];
+	PFC_CNT        cnt[7] = {0,0,0,0,0,0,0};
+	PFC_SAMPLER    smp;
+
+
+	/**
+	 * Process command line arguments
+	 */
+
+	while((option = getopt(argc, argv, "c:n:o:h")) != -1){
+		switch(option){
+			case 'c': core    = strtol (optarg, 0, 0); break;
+			case 'n': n       = strtoul(optarg, 0, 0); break;
+			case 'o': outPath = optarg;                break;
+			default:
+				fprintf(stderr, "Usage: pfcoverhead [-c core] [-n samples] [-o report.txt]\n"
+				                "\t-c\n\t\tCore to run on (default: current)\n"
+				                "\t-n\n\t\tSamples per operation (default 10000, 1/10th for syscalls that reconfigure)\n"
+				                "\t-o\n\t\tWrite the report to this file (default stdout)\n");
+			exit(option == 'h' ? 0 : 1);
+		}
+	}
+	n     = n < 1 ? 1 : n;
+	nSlow = n/10 < 1 ? 1 : n/10;
+
+
+	/**
+	 * Initialize library. Count cycles in both user and OS mode so that the
+	 * kernel side of sysfs accesses is accounted for.
+	 */
+
+	core = core >= 0 ? core : sched_getcpu();
+	pfcPinThread(core);
+	if((ret = pfcInit()) != 0){
+		fprintf(stderr, "pfcoverhead: %s\n", pfcErrorString(ret));
+		return 1;
+	}
+	if(outPath && !(out = fopen(outPath, "w"))){
+		fprintf(stderr, "pfcoverhead: Could not open %s!\n", outPath);
+		return 1;
+	}
+	cfg[0] = cfg[1] = cfg[2] = 3;
+	cfg[3] = pfcParseCfg("uops_issued.any:uk");
+	cfg[4] = pfcParseCfg("uops_retired.all:uk");
+	cfg[5] = pfcParseCfg("br_inst_retired.all_branches:uk");
+	cfg[6] = pfcParseCfg("*cpl_cycles.ring0>=1:uk");
+	if((ret = pfcWrCfgs(0, 7, cfg)) != 0){
+		fprintf(stderr, "pfcoverhead: %s\n", pfcErrorString(ret));
+		return 1;
+	}
+	pfcWrCnts(0, 7, cnt);
+	pfcRdCfgs(0, 7, cfgSave);
+
+	cyc = malloc(n*sizeof(*cyc));
+	tsc = malloc(n*sizeof(*tsc));
+	if(!cyc || !tsc){
+		fprintf(stderr, "pfcoverhead: Out of memory!\n");
+		return 1;
+	}
+
+
+	/**
+	 * Header. Everything that varies between hosts and kernel releases goes
+	 * here, so that reports diff cleanly.
+	 */
+
+	uname(&uts);
+	fprintf(out, "# pfcoverhead report\n");
+	fprintf(out, "# kernel  %s %s\n", uts.release, uts.version);
+	fprintf(out, "# core    %d\n", core);
+	fprintf(out, "# tsc     %.3f MHz\n", pfcClkInit()->tscHz/1e6);
+	fprintf(out, "#\n");
+	fprintf(out, "# %-22s %-6s %8s %10s %10s %10s %10s %10s %10s %10s\n",
+	        "operation", "unit", "n", "min", "p50", "p90", "p99", "max", "mean", "stddev");
+
+
+	/**
+	 * Calibrate the cost of the empty bracket as its minimum over all samples,
+	 * then subtract it from all the following measurements.
+	 */
+
+	nullCyc = nullTsc = 1e300;
+	for(i=0;i<(int)n;i++){
+		uint64_t c0, c1, t0, t1;
+		STAMP(c0, t0);
+		STAMP(c1, t1);
+		nullCyc = (double)(c1-c0) < nullCyc ? (double)(c1-c0) : nullCyc;
+		nullTsc = (double)(t1-t0) < nullTsc ? (double)(t1-t0) : nullTsc;
+	}
+	MEASURE("empty",                 n,     (void)0);
+
+
+	/**
+	 * Userspace-only paths.
+	 */
+
+	MEASURE("PFCSTART+PFCEND",       n,     {PFCSTART(cnt); PFCEND(cnt);});
+	MEASURE("pfcRemoveBias",         nSlow, pfcRemoveBias(cnt, 1));
+	pfcSamplerInit(&smp, 0);  /* Budget 0: Stays at 1-in-16, so p50 is the skip path */
+	MEASURE("PFC*_SAMPLED",          n,     {PFCSTART_SAMPLED(&smp); PFCEND_SAMPLED(&smp);});
+
+
+	/**
+	 * Sysfs paths. Counter writes are restricted to the general-purpose
+	 * counters so as not to reset the fixed cycle counter we time with;
+	 * Configuration writes rewrite the current configuration of the last n
+	 * counters, which gates the fixed counters off for n >= 5, so those are
+	 * timed by the TSC alone.
+	 */
+
+	MEASURE("pfcRdCnts(0,7)",        n,     pfcRdCnts(0, 7, cnt));
+	MEASURE("pfcRdCfgs(0,7)",        n,     pfcRdCfgs(0, 7, cfg));
+	for(i=1;i<=4;i++){
+		snprintf(name, sizeof(name), "pfcWrCnts(%d,%d)", 3, i);
+		MEASURE(name,                n,     pfcWrCnts(3, i, cnt+3));
+	}
+	for(i=1;i<=7;i++){
+		snprintf(name, sizeof(name), "pfcWrCfgs(%d,%d)", 7-i, i);
+		if(7-i >= 3){
+			MEASURE    (name,            nSlow, pfcWrCfgs(7-i, i, cfgSave+7-i));
+		}else{
+			MEASURE_TSC(name,            nSlow, pfcWrCfgs(7-i, i, cfgSave+7-i));
+		}
+	}
+	MEASURE("pfcRdMSR(PLATFORM_INFO)", n,   pfcRdMSR(MSR_PLATFORM_INFO, &msr));
+	MEASURE("pfcRdMSR(PERF_STATUS)", n,     pfcRdMSR(MSR_IA32_PERF_STATUS, &msr));
+	MEASURE("pfcPinThread",          nSlow, pfcPinThread(core));
+
+
+	/**
+	 * Close up shop
+	 */
+
+	if(out != stdout){
+		fclose(out);
+	}
+	free(cyc);
+	free(tsc);
+	pfcFini();
+	return 0;
+}
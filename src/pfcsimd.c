@@ -0,0 +1,362 @@
+/* Includes */
+#define _GNU_SOURCE
+
+#include "libpfc.h"
+#include <cpuid.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* Defines */
+
+/**
+ * Exit code understood by Meson as "skipped", used when pfc.ko is absent.
+ */
+
+#define EXIT_SKIP                         77
+
+/**
+ * Every kernel iteration is 12 vector instructions on registers 0-11 of its
+ * width, each combining register 15 into one of C chains (instruction i into
+ * register i%C), so that C = 1 measures latency and large C throughput.
+ */
+
+#define NINSN                             12
+
+#define SIMD_REG(p, d)        "%%" p #d
+#define SIMD_2OP(ins, p, d)   ins " " SIMD_REG(p, 15) ", " SIMD_REG(p, d) "\n\t"
+#define SIMD_3OP(ins, p, d)   ins " " SIMD_REG(p, 15) ", " SIMD_REG(p, d) ", " SIMD_REG(p, d) "\n\t"
+
+#define SIMD_BODY_1(F, ins, p)  F(ins,p,0) F(ins,p,0) F(ins,p,0)  F(ins,p,0)  \
+                                F(ins,p,0) F(ins,p,0) F(ins,p,0)  F(ins,p,0)  \
+                                F(ins,p,0) F(ins,p,0) F(ins,p,0)  F(ins,p,0)
+#define SIMD_BODY_2(F, ins, p)  F(ins,p,0) F(ins,p,1) F(ins,p,0)  F(ins,p,1)  \
+                                F(ins,p,0) F(ins,p,1) F(ins,p,0)  F(ins,p,1)  \
+                                F(ins,p,0) F(ins,p,1) F(ins,p,0)  F(ins,p,1)
+#define SIMD_BODY_3(F, ins, p)  F(ins,p,0) F(ins,p,1) F(ins,p,2)  F(ins,p,0)  \
+                                F(ins,p,1) F(ins,p,2) F(ins,p,0)  F(ins,p,1)  \
+                                F(ins,p,2) F(ins,p,0) F(ins,p,1)  F(ins,p,2)
+#define SIMD_BODY_4(F, ins, p)  F(ins,p,0) F(ins,p,1) F(ins,p,2)  F(ins,p,3)  \
+                                F(ins,p,0) F(ins,p,1) F(ins,p,2)  F(ins,p,3)  \
+                                F(ins,p,0) F(ins,p,1) F(ins,p,2)  F(ins,p,3)
+#define SIMD_BODY_6(F, ins, p)  F(ins,p,0) F(ins,p,1) F(ins,p,2)  F(ins,p,3)  \
+                                F(ins,p,4) F(ins,p,5) F(ins,p,0)  F(ins,p,1)  \
+                                F(ins,p,2) F(ins,p,3) F(ins,p,4)  F(ins,p,5)
+#define SIMD_BODY_12(F, ins, p) F(ins,p,0) F(ins,p,1) F(ins,p,2)  F(ins,p,3)  \
+                                F(ins,p,4) F(ins,p,5) F(ins,p,6)  F(ins,p,7)  \
+                                F(ins,p,8) F(ins,p,9) F(ins,p,10) F(ins,p,11)
+
+/**
+ * pfcdemo's mix: Two FMAs for every VPADDD, 12 independent chains.
+ */
+
+#define SIMD_BODY_MIX(p)                                                      \
+	SIMD_3OP("vfmadd231ps", p, 0) SIMD_3OP("vfmadd231ps", p, 1)               \
+	SIMD_3OP("vpaddd",      p, 2) SIMD_3OP("vfmadd231ps", p, 3)               \
+	SIMD_3OP("vfmadd231ps", p, 4) SIMD_3OP("vpaddd",      p, 5)               \
+	SIMD_3OP("vfmadd231ps", p, 6) SIMD_3OP("vfmadd231ps", p, 7)               \
+	SIMD_3OP("vpaddd",      p, 8) SIMD_3OP("vfmadd231ps", p, 9)               \
+	SIMD_3OP("vfmadd231ps", p, 10) SIMD_3OP("vpaddd",     p, 11)
+
+/**
+ * Zero the registers used. VZEROALL would be an AVX instruction in an SSE
+ * kernel, and thus a state transition of its own.
+ */
+
+#define SIMD_ZERO_SSE                                                         \
+	"pxor %%xmm0, %%xmm0\n\t"   "pxor %%xmm1, %%xmm1\n\t"                     \
+	"pxor %%xmm2, %%xmm2\n\t"   "pxor %%xmm3, %%xmm3\n\t"                     \
+	"pxor %%xmm4, %%xmm4\n\t"   "pxor %%xmm5, %%xmm5\n\t"                     \
+	"pxor %%xmm6, %%xmm6\n\t"   "pxor %%xmm7, %%xmm7\n\t"                     \
+	"pxor %%xmm8, %%xmm8\n\t"   "pxor %%xmm9, %%xmm9\n\t"                     \
+	"pxor %%xmm10, %%xmm10\n\t" "pxor %%xmm11, %%xmm11\n\t"                   \
+	"pxor %%xmm15, %%xmm15\n\t"
+#define SIMD_ZERO_AVX         "vzeroall\n\t"
+
+#define SIMD_LOOP(zero, body)                                                 \
+	asm volatile(                                                             \
+	zero                                                                      \
+	"0:\n\t"                                                                  \
+	body                                                                      \
+	"dec             %0\n\t"                                                  \
+	"jnz             0b\n\t"                                                  \
+	: "+r"(n)                                                                 \
+	:                                                                         \
+	: "xmm0",  "xmm1",  "xmm2",  "xmm3",  "xmm4",  "xmm5",  "xmm6",  "xmm7",  \
+	  "xmm8",  "xmm9", "xmm10", "xmm11", "xmm15", "cc"                        \
+	)
+
+#define SIMD_KERNEL(isa, op, C, zero, F, ins, p)                              \
+	static void k_##isa##_##op##_##C(uint64_t n){                             \
+		SIMD_LOOP(zero, SIMD_BODY_##C(F, ins, p));                            \
+	}
+#define SIMD_KERNELS(isa, op, zero, F, ins, p)                                \
+	SIMD_KERNEL(isa, op,  1, zero, F, ins, p)                                 \
+	SIMD_KERNEL(isa, op,  2, zero, F, ins, p)                                 \
+	SIMD_KERNEL(isa, op,  3, zero, F, ins, p)                                 \
+	SIMD_KERNEL(isa, op,  4, zero, F, ins, p)                                 \
+	SIMD_KERNEL(isa, op,  6, zero, F, ins, p)                                 \
+	SIMD_KERNEL(isa, op, 12, zero, F, ins, p)
+#define SIMD_ROWS(isa, op, lanes)                                             \
+	{#isa, #op,  1, lanes, k_##isa##_##op##_1 },                              \
+	{#isa, #op,  2, lanes, k_##isa##_##op##_2 },                              \
+	{#isa, #op,  3, lanes, k_##isa##_##op##_3 },                              \
+	{#isa, #op,  4, lanes, k_##isa##_##op##_4 },                              \
+	{#isa, #op,  6, lanes, k_##isa##_##op##_6 },                              \
+	{#isa, #op, 12, lanes, k_##isa##_##op##_12}
+
+
+/* Data Structures */
+struct KERNEL;
+typedef struct KERNEL KERNEL;
+struct RUN;
+typedef struct RUN RUN;
+
+struct KERNEL{
+	const char*   isa;
+	const char*   op;
+	int           chains;
+	int           lanes;   /* 32-bit elements per instruction */
+	void        (*run)(uint64_t n);
+};
+
+/**
+ * One measured run: Kernel k for n iterations, clearing the upper halves of
+ * the vector registers afterwards unless dirty.
+ */
+
+struct RUN{
+	const KERNEL* k;
+	uint64_t      n;
+	int           dirty;
+};
+
+
+/* Kernels */
+SIMD_KERNELS(sse,    add,  SIMD_ZERO_SSE, SIMD_2OP, "addps",       "xmm")
+SIMD_KERNELS(sse,    mul,  SIMD_ZERO_SSE, SIMD_2OP, "mulps",       "xmm")
+SIMD_KERNELS(sse,    iadd, SIMD_ZERO_SSE, SIMD_2OP, "paddd",       "xmm")
+SIMD_KERNELS(avx2,   add,  SIMD_ZERO_AVX, SIMD_3OP, "vaddps",      "ymm")
+SIMD_KERNELS(avx2,   mul,  SIMD_ZERO_AVX, SIMD_3OP, "vmulps",      "ymm")
+SIMD_KERNELS(avx2,   fma,  SIMD_ZERO_AVX, SIMD_3OP, "vfmadd231ps", "ymm")
+SIMD_KERNELS(avx2,   iadd, SIMD_ZERO_AVX, SIMD_3OP, "vpaddd",      "ymm")
+SIMD_KERNELS(avx512, add,  SIMD_ZERO_AVX, SIMD_3OP, "vaddps",      "zmm")
+SIMD_KERNELS(avx512, mul,  SIMD_ZERO_AVX, SIMD_3OP, "vmulps",      "zmm")
+SIMD_KERNELS(avx512, fma,  SIMD_ZERO_AVX, SIMD_3OP, "vfmadd231ps", "zmm")
+SIMD_KERNELS(avx512, iadd, SIMD_ZERO_AVX, SIMD_3OP, "vpaddd",      "zmm")
+
+static void k_avx2_mix_12  (uint64_t n){SIMD_LOOP(SIMD_ZERO_AVX, SIMD_BODY_MIX("ymm"));}
+static void k_avx512_mix_12(uint64_t n){SIMD_LOOP(SIMD_ZERO_AVX, SIMD_BODY_MIX("zmm"));}
+
+static const KERNEL KERNELS[] = {
+	SIMD_ROWS(sse,    add,   4),
+	SIMD_ROWS(sse,    mul,   4),
+	SIMD_ROWS(sse,    iadd,  4),
+	SIMD_ROWS(avx2,   add,   8),
+	SIMD_ROWS(avx2,   mul,   8),
+	SIMD_ROWS(avx2,   fma,   8),
+	SIMD_ROWS(avx2,   iadd,  8),
+	{"avx2",   "mix", 12,  8, k_avx2_mix_12  },
+	SIMD_ROWS(avx512, add,  16),
+	SIMD_ROWS(avx512, mul,  16),
+	SIMD_ROWS(avx512, fma,  16),
+	SIMD_ROWS(avx512, iadd, 16),
+	{"avx512", "mix", 12, 16, k_avx512_mix_12},
+	{NULL,     NULL,   0,  0, NULL           }
+};
+
+
+/* Global data */
+
+/**
+ * Two groups of general-purpose events, which every kernel is measured under
+ * in turn: The vector ALU ports (0, 1 and 5 on Haswell through Skylake, 6
+ * being the loop branch), then SSE/AVX transition assists.
+ */
+
+static const char* const EVTGROUPS[2][4] = {
+	{"uops_executed_port.port_0",
+	 "uops_executed_port.port_1",
+	 "uops_executed_port.port_5",
+	 "uops_executed_port.port_6"},
+	{"other_assists.avx_to_sse",
+	 "other_assists.sse_to_avx",
+	 "uops_issued.any",
+	 "uops_retired.all"},
+};
+
+
+/* Helpers */
+
+/**
+ * Whether the processor and OS support the ISA of a kernel: AVX2 with FMA,
+ * and AVX-512F with the OS saving the opmask and ZMM state.
+ */
+
+static int  hasIsa(const char* isa){
+	unsigned a, b, c, d, xcr0lo, xcr0hi;
+
+	if(strcmp(isa, "sse") == 0){
+		return 1;
+	}
+	__cpuid(1, a, b, c, d);
+	if(!(c & (1u<<12)) || !(c & (1u<<27)) || !(c & (1u<<28))){
+		return 0;
+	}
+	asm volatile("xgetbv" : "=a"(xcr0lo), "=d"(xcr0hi) : "c"(0));
+	__cpuid_count(7, 0, a, b, c, d);
+	if(strcmp(isa, "avx2") == 0){
+		return (b & (1u<<5)) && (xcr0lo & 0x6) == 0x6;
+	}
+	return (b & (1u<<16)) && (xcr0lo & 0xE6) == 0xE6;
+}
+
+/**
+ * Run a kernel once, then clear the upper halves of the vector registers
+ * unless dirty, as compilers do on leaving AVX code. The VZEROUPPER falls
+ * inside the measured bracket, at 1 instruction in 12*n.
+ */
+
+static void runKernel(void* arg){
+	const RUN* p = arg;
+
+	p->k->run(p->n);
+	if(!p->dirty && strcmp(p->k->isa, "sse") != 0){
+		asm volatile("vzeroupper");
+	}
+}
+
+/**
+ * Measure one kernel under both event groups, writing into out the median
+ * count per instruction of the 3 fixed counters and the 8 events. Exits if
+ * an event group cannot be programmed.
+ */
+
+static void measure(const KERNEL* k, uint64_t n, int reps, int dirty, double* out){
+	RUN    p = {k, n, dirty};
+	double res[7];
+	int    g, i, ret;
+
+	for(g=0;g<2;g++){
+		if((ret = pfcMeasure(EVTGROUPS[g], runKernel, &p, reps, n*NINSN, res)) != 0){
+			fprintf(stderr, "pfcsimd: Event group %s, %s, %s, %s: %s\n",
+			        EVTGROUPS[g][0], EVTGROUPS[g][1], EVTGROUPS[g][2],
+			        EVTGROUPS[g][3], pfcErrorString(ret));
+			exit(1);
+		}
+		for(i=g?3:0;i<7;i++){
+			out[i < 3 ? i : 3+4*g+i-3] = res[i];
+		}
+	}
+}
+
+
+/**
+ * Main
+ */
+
+int main(int argc, char* argv[]){
+	int           i, j, option, ret, core = -1, reps = 5, json = 0, dirty = 0;
+	uint64_t      n = 1000000;
+	double        res[11], ghz, cpi;
+	const char*   onlyIsa = NULL;
+	const char*   onlyOp  = NULL;
+	PFC_PLACEMENT place;
+
+
+	/**
+	 * Process command line arguments
+	 */
+
+	while((option = getopt(argc, argv, "c:r:n:i:o:djh")) != -1){
+		switch(option){
+			case 'c': core    = strtol (optarg, 0, 0); break;
+			case 'r': reps    = strtol (optarg, 0, 0); break;
+			case 'n': n       = strtoull(optarg, 0, 0); break;
+			case 'i': onlyIsa = optarg;                break;
+			case 'o': onlyOp  = optarg;                break;
+			case 'd': dirty   = 1;                     break;
+			case 'j': json    = 1;                     break;
+			default:
+				fprintf(stderr, "Usage: pfcsimd [-c core] [-r reps] [-n iters] [-i isa] [-o op] [-d] [-j]\n"
+				                "\t-c\n\t\tCore to run on (default: chosen by pfcPlace())\n"
+				                "\t-r\n\t\tRepetitions per kernel, median reported (default 5, max %d)\n"
+				                "\t-n\n\t\tLoop iterations of %d instructions per run (default 1000000)\n"
+				                "\t-i\n\t\tRun only this ISA (sse, avx2, avx512)\n"
+				                "\t-o\n\t\tRun only this operation (add, mul, fma, iadd, mix)\n"
+				                "\t-d\n\t\tDo not VZEROUPPER after AVX kernels, exposing SSE/AVX transitions\n"
+				                "\t-j\n\t\tPrint one JSON object per kernel instead of a table\n",
+				                PFC_MEASURE_MAXREPS, NINSN);
+			exit(option == 'h' ? 0 : 1);
+		}
+	}
+	reps = reps < 1 ? 1 : reps > PFC_MEASURE_MAXREPS ? PFC_MEASURE_MAXREPS : reps;
+	n    = n    < 1 ? 1 : n;
+
+
+	/**
+	 * Initialize library, on a quiet core.
+	 */
+
+	if(core >= 0){
+		pfcPinThread(core);
+	}else{
+		pfcPlace(0, &place);
+	}
+	if((ret = pfcInit()) != 0){
+		fprintf(stderr, "pfcsimd: %s\n", pfcErrorString(ret));
+		exit(ret == PFC_ERR_OPENING_SYSFILE ? EXIT_SKIP : 1);
+	}
+	if(!json){
+		printf("%-6s %-4s %3s %7s %7s %7s %6s %6s | %5s %5s %5s %5s | %8s %8s\n",
+		       "isa", "op", "C", "cyc/ins", "ins/cyc", "Gelem/s", "GHz", "cyc/ref",
+		       "p0", "p1", "p5", "p6", "avx>sse", "sse>avx");
+	}
+
+
+	/**
+	 * Run every available kernel. Per-instruction cost and port use come from
+	 * the counters; Element throughput in wall-clock time, from the reference
+	 * cycles, includes any frequency drop the kernel's vector width causes.
+	 */
+
+	for(i=0;KERNELS[i].isa;i++){
+		if((onlyIsa && strcmp(onlyIsa, KERNELS[i].isa) != 0) ||
+		   (onlyOp  && strcmp(onlyOp,  KERNELS[i].op)  != 0) ||
+		   !hasIsa(KERNELS[i].isa)){
+			continue;
+		}
+		measure(&KERNELS[i], n, reps, dirty, res);
+		cpi = res[1];
+		ghz = res[1]*n*NINSN / pfcRefToNs((int64_t)(res[2]*n*NINSN));
+
+		if(json){
+			printf("{\"isa\": \"%s\", \"op\": \"%s\", \"chains\": %d, "
+			       "\"cycles_per_insn\": %.4f, \"gelem_per_s\": %.3f, "
+			       "\"ghz\": %.3f, \"core_per_ref\": %.4f",
+			       KERNELS[i].isa, KERNELS[i].op, KERNELS[i].chains,
+			       cpi, KERNELS[i].lanes*ghz/cpi, ghz, res[1]/res[2]);
+			for(j=0;j<8;j++){
+				printf(", \"%s\": %.4f", EVTGROUPS[j/4][j%4], res[3+j]);
+			}
+			printf("}\n");
+		}else{
+			printf("%-6s %-4s %3d %7.3f %7.3f %7.2f %6.3f %6.3f | %5.2f %5.2f %5.2f %5.2f | %8.4f %8.4f\n",
+			       KERNELS[i].isa, KERNELS[i].op, KERNELS[i].chains,
+			       cpi, 1/cpi, KERNELS[i].lanes*ghz/cpi, ghz, res[1]/res[2],
+			       res[3], res[4], res[5], res[6], res[7], res[8]);
+		}
+		fflush(stdout);
+	}
+
+
+	/**
+	 * Cleanup
+	 */
+
+	pfcFini();
+	return 0;
+}
@@ -1,23 +1,324 @@
 /* Includes */
+#define _GNU_SOURCE
+
 #include "libpfc.h"
 #include <ctype.h>
 #include <math.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 
+/* Defines */
+#define MAXEVT                             4
+#define MAXREP                             1000
 
 /**
- * Main
+ * Exit statuses of a child that could not set up its counters or exec.
  */
 
-int main(int argc, char* argv[]){
-	if(pfcInit() != 0){
-		printf("Could not open /sys/module/pfc/* handles; Is module loaded?\n");
-		exit(1);
+#define CHILD_SETUP_FAILED                 125
+#define CHILD_EXEC_FAILED                  127
+
+#define FMT_TEXT                           0
+#define FMT_JSON                           1
+#define FMT_CSV                            2
+
+
+/* Data Structures */
+struct STAT;
+typedef struct STAT STAT;
+
+/**
+ * One pfcutil stat session. cnt holds the unbiased counts of every run.
+ */
+
+struct STAT{
+	int         core;
+	int         reps;
+	int         fmt;
+	int         kernel;
+	int         nevt;
+	const char* names[7];
+	PFC_CFG     cfg[7];
+	uint64_t    rsp[2];
+	PFC_CNT     bias[7];
+	double      cnt[7][MAXREP];
+	char**      argv;
+};
+
+
+
+/* Static Function Definitions */
+
+/**
+ * Configure and zero the counters of the core the child was pinned to, then
+ * exec the command, or exit at once if there is none (bias calibration).
+ * Whatever the child runs in user mode from the zeroing on is counted.
+ */
+
+static void            pfcutilChild     (const STAT* st){
+	static const PFC_CNT zero[7] = {0,0,0,0,0,0,0};
+	int                  ret;
+
+	if((ret = pfcPinThread(st->core))                                       ||
+	   ((st->rsp[0] || st->rsp[1]) && (ret = pfcWrOffcore(0, 2, st->rsp))) ||
+	   (ret = pfcWrCfgs(0, 7, st->cfg))){
+		fprintf(stderr, "pfcutil: Could not set up core %d: %s\n",
+		        st->core, pfcErrorString(ret));
+		_exit(CHILD_SETUP_FAILED);
 	}
-	
+	if(pfcWrCnts(0, 7, zero) != sizeof(zero)){
+		fprintf(stderr, "pfcutil: Could not zero the counters of core %d!\n", st->core);
+		_exit(CHILD_SETUP_FAILED);
+	}
+	if(st->argv){
+		execvp(st->argv[0], st->argv);
+		_exit(CHILD_EXEC_FAILED);
+	}
+	_exit(0);
+}
+
+/**
+ * Fork a child on the chosen core and collect its counts once it exits.
+ *
+ * The counters are read remotely if pfc.ko supports it, or else by migrating
+ * onto the core; Either way, calibration runs pay the same overhead.
+ *
+ * @return The child's wait status, or -1
+ */
+
+static int             pfcutilRun       (const STAT* st, PFC_CNT* cnt){
+	pid_t     pid;
+	int       status;
+	cpu_set_t saved;
+
+	fflush(NULL);
+	if((pid = fork()) < 0){
+		return -1;
+	}else if(pid == 0){
+		pfcutilChild(st);
+	}
+	while(waitpid(pid, &status, 0) < 0){
+		continue;
+	}
+
+	if(pfcRdCntsOn(st->core, 0, 7, cnt) != 7*sizeof(*cnt)){
+		sched_getaffinity(0, sizeof(saved), &saved);
+		pfcPinThread(st->core);
+		pfcRdCnts(0, 7, cnt);
+		sched_setaffinity(0, sizeof(saved), &saved);
+	}
+	return status;
+}
+
+/**
+ * Whether a child's wait status says it could not set up its counters, in
+ * which case its counts are meaningless.
+ */
+
+static int             pfcutilSetupFailed(int status){
+	return WIFEXITED(status) && WEXITSTATUS(status) == CHILD_SETUP_FAILED;
+}
+
+/**
+ * Measure the counts of a child that exits right after zeroing the counters.
+ * Their median is what every run counts besides the command itself.
+ *
+ * @return 0, or -1 if a child could not set up the counters
+ */
+
+static int             pfcutilCalibrate (STAT* st){
+	char**    argv = st->argv;
+	PFC_CNT   cnt[7];
+	PFC_STATS s;
+	double    x[16][7], y[16];
+	int       i, j, n = sizeof(x)/sizeof(*x);
+
+	st->argv = NULL;
+	for(i=0;i<n;i++){
+		if(pfcutilSetupFailed(pfcutilRun(st, cnt))){
+			st->argv = argv;
+			return -1;
+		}
+		for(j=0;j<7;j++){
+			x[i][j] = cnt[j];
+		}
+	}
+	st->argv = argv;
+
+	for(j=0;j<7;j++){
+		for(i=0;i<n;i++){
+			y[i] = x[i][j];
+		}
+		st->bias[j] = pfcStats(y, n, &s) == 0 ? (PFC_CNT)s.p50 : 0;
+	}
+	return 0;
+}
+
+/**
+ * Print the median, minimum and maximum of every counter over the runs, and
+ * the IPC of the medians.
+ */
+
+static void            pfcutilReport    (const STAT* st, int status){
+	PFC_STATS s[7];
+	double    ipc;
+	int       i;
+
+	for(i=0;i<3+st->nevt;i++){
+		pfcStats(st->cnt[i], st->reps, &s[i]);
+	}
+	ipc = s[1].p50 > 0 ? s[0].p50/s[1].p50 : 0;
+
+	switch(st->fmt){
+		case FMT_JSON:
+			printf("{\"command\": \"%s\", \"core\": %d, \"runs\": %d, \"status\": %d,"
+			       " \"ipc\": %.4f, \"counters\": [", st->argv[0], st->core,
+			       st->reps, status, ipc);
+			for(i=0;i<3+st->nevt;i++){
+				printf("%s\n  {\"event\": \"%s\", \"median\": %.0f, \"min\": %.0f,"
+				       " \"max\": %.0f, \"bias\": %lld}", i ? "," : "",
+				       st->names[i], s[i].p50, s[i].min, s[i].max,
+				       (long long)st->bias[i]);
+			}
+			printf("\n]}\n");
+		break;
+		case FMT_CSV:
+			printf("event,median,min,max,bias\n");
+			for(i=0;i<3+st->nevt;i++){
+				printf("%s,%.0f,%.0f,%.0f,%lld\n", st->names[i], s[i].p50,
+				       s[i].min, s[i].max, (long long)st->bias[i]);
+			}
+			printf("ipc,%.4f,,,\n", ipc);
+		break;
+		default:
+			fprintf(stderr, "\n Counts for '%s' on core %d (median of %d run(s), %s):\n\n",
+			        st->argv[0], st->core, st->reps, st->kernel ? "user+kernel" : "user");
+			for(i=0;i<3+st->nevt;i++){
+				fprintf(stderr, "%20.0f  %-40s (%.0f - %.0f)\n", s[i].p50,
+				        st->names[i], s[i].min, s[i].max);
+			}
+			fprintf(stderr, "\n%20.4f  IPC\n\n", ipc);
+		break;
+	}
+}
+
+/**
+ * pfcutil stat [options] [--] command [args...]
+ */
+
+static int             pfcutilStat      (int argc, char* argv[]){
+	static STAT st;
+	PFC_CNT     cnt[7];
+	int         option, i, j, status = 0;
+
+	st.core    = -1;
+	st.reps    = 1;
+	st.fmt     = FMT_TEXT;
+	st.names[0] = "inst_retired.any";
+	st.names[1] = "cpu_clk_unhalted.thread";
+	st.names[2] = "cpu_clk_unhalted.ref_tsc";
+
+	optind = 1;
+	while((option = getopt(argc, argv, "+c:e:r:kjxh")) != -1){
+		switch(option){
+			case 'c': st.core   = strtol(optarg, 0, 0); break;
+			case 'r': st.reps   = strtol(optarg, 0, 0); break;
+			case 'k': st.kernel = 1;                    break;
+			case 'j': st.fmt    = FMT_JSON;             break;
+			case 'x': st.fmt    = FMT_CSV;              break;
+			case 'e':
+				if(st.nevt >= MAXEVT){
+					fprintf(stderr, "pfcutil: At most %d events!\n", MAXEVT);
+					return 1;
+				}
+				st.names[3+st.nevt++] = optarg;
+			break;
+			default:
+				fprintf(stderr, "Usage: pfcutil stat [-c core] [-e event]... [-r runs] [-k] [-j|-x] [--] command [args...]\n"
+				                "\t-c\n\t\tCore to run the command on (default: current)\n"
+				                "\t-e\n\t\tGeneral-purpose counter event, as for pfcParseCfg() (up to 4)\n"
+				                "\t-r\n\t\tRun the command this many times and report medians (default 1)\n"
+				                "\t-k\n\t\tAlso count kernel mode\n"
+				                "\t-j\n\t\tPrint JSON to stdout\n"
+				                "\t-x\n\t\tPrint CSV to stdout\n"
+				                "Counting is per core, not per process: Keep the core otherwise idle.\n");
+			return option == 'h' ? 0 : 1;
+		}
+	}
+	if(optind >= argc){
+		fprintf(stderr, "pfcutil: No command given!\n");
+		return 1;
+	}
+	if(st.reps < 1 || st.reps > MAXREP){
+		fprintf(stderr, "pfcutil: Runs must be between 1 and %d!\n", MAXREP);
+		return 1;
+	}
+	st.argv = argv+optind;
+	st.core = st.core >= 0 ? st.core : sched_getcpu();
+
+
+	/**
+	 * Configure the fixed counters and events, user mode only unless asked
+	 * otherwise.
+	 */
+
+	st.cfg[0] = st.cfg[1] = st.cfg[2] = st.kernel ? 3 : 2;
+	for(i=0;i<st.nevt;i++){
+		st.cfg[3+i] = pfcParseCfg(st.names[3+i]);
+		if(!st.cfg[3+i]){
+			fprintf(stderr, "pfcutil: Unknown event '%s'!\n", st.names[3+i]);
+			return 1;
+		}
+		if(st.kernel){
+			st.cfg[3+i] |= 1ULL<<17;
+		}
+		if(strchr(st.names[3+i], '@')){
+			st.rsp[((st.cfg[3+i] & 0xFF) == 0xBB)] = pfcParseOffcore(st.names[3+i]);
+		}
+	}
+
+
+	/**
+	 * Calibrate, then run.
+	 */
+
+	if(pfcutilCalibrate(&st) != 0){
+		fprintf(stderr, "pfcutil: Counters could not be set up; No counts reported.\n");
+		return CHILD_SETUP_FAILED;
+	}
+	for(i=0;i<st.reps;i++){
+		if((status = pfcutilRun(&st, cnt)) == -1){
+			fprintf(stderr, "pfcutil: Could not fork!\n");
+			return 1;
+		}
+		if(pfcutilSetupFailed(status)){
+			fprintf(stderr, "pfcutil: Counters could not be set up; No counts reported.\n");
+			return CHILD_SETUP_FAILED;
+		}
+		if(WIFEXITED(status) && WEXITSTATUS(status) == CHILD_EXEC_FAILED){
+			fprintf(stderr, "pfcutil: Could not run '%s'!\n", st.argv[0]);
+			return CHILD_EXEC_FAILED;
+		}
+		status = WIFEXITED(status) ? WEXITSTATUS(status) : 128+WTERMSIG(status);
+		for(j=0;j<7;j++){
+			st.cnt[j][i] = cnt[j] > st.bias[j] ? cnt[j] - st.bias[j] : 0;
+		}
+	}
+	pfcutilReport(&st, status);
+	return status;
+}
+
+/**
+ * pfcutil msr: Read the energy-performance bias.
+ */
+
+static int             pfcutilMsr       (void){
 	unsigned msrNum = MSR_IA32_ENERGY_PERF_BIAS;
 	uint64_t msr    = 0;
 	if(pfcRdMSR(msrNum, &msr) == sizeof(msr)){
@@ -25,7 +326,27 @@ int main(int argc, char* argv[]){
 	}else{
 		printf("Failed to read MSR %03x!\n", msrNum);
 	}
-	
-	
 	return 0;
 }
+
+
+/**
+ * Main
+ */
+
+int main(int argc, char* argv[]){
+	if(pfcInit() != 0){
+		printf("Could not open /sys/module/pfc/* handles; Is module loaded?\n");
+		exit(1);
+	}
+
+	if(argc >= 2 && strcmp(argv[1], "stat") == 0){
+		return pfcutilStat(argc-1, argv+1);
+	}else if(argc < 2 || strcmp(argv[1], "msr") == 0){
+		return pfcutilMsr();
+	}
+
+	fprintf(stderr, "Usage: pfcutil [msr]\n"
+	                "       pfcutil stat [-h] ... command [args...]\n");
+	return 1;
+}